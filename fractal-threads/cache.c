@@ -0,0 +1,268 @@
+/*
+cache.c - A memory bounded cache of finished tiles.
+
+Entries sit in a hash table for lookups and on a doubly linked list
+from newest to oldest for eviction.  Each one is a single allocation
+holding the counts and colors after the entry itself.
+
+A tile in the directory is a file named after the hash of its key,
+holding the key, the size, and the counts and colors.  The key is
+checked on loading, so two keys with the same hash only cost a miss.
+Files are written under a temporary name and renamed into place, so
+another process never sees half of one.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* FNV-1a over the bytes of the key. */
+
+static unsigned long long cache_hash( const struct cache_key *key )
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned long long h = 14695981039346656037ULL;
+
+	for(size_t i=0;i<sizeof(*key);i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+static size_t cache_entry_bytes( int w, int h )
+{
+	return sizeof(struct cache_entry) + (size_t)w*h*(sizeof(int)+sizeof(unsigned int));
+}
+
+struct cache *cache_create( size_t maxbytes, const char *dir )
+{
+	struct cache *c = calloc(1,sizeof(*c));
+	if(!c) return 0;
+
+	c->maxbytes = maxbytes;
+
+	if(dir) {
+		c->dir = strdup(dir);
+		if(!c->dir) {
+			free(c);
+			return 0;
+		}
+	}
+
+	return c;
+}
+
+/* Put the path of the key's file in path. */
+
+static void cache_path( struct cache *c, const struct cache_key *key, char *path, size_t size )
+{
+	snprintf(path,size,"%s/%016llx.tile",c->dir,cache_hash(key));
+}
+
+/* Write an entry to the directory. Return 0 on failure. */
+
+static int cache_save( struct cache *c, struct cache_entry *e )
+{
+	char path[4096];
+	char temp[4096];
+	size_t n = (size_t)e->w*e->h;
+
+	cache_path(c,&e->key,path,sizeof(path));
+	snprintf(temp,sizeof(temp),"%s/%016llx.%d",c->dir,cache_hash(&e->key),(int)getpid());
+
+	FILE *file = fopen(temp,"wb");
+	if(!file) return 0;
+
+	int ok = fwrite(&e->key,sizeof(e->key),1,file)==1
+		&& fwrite(&e->w,sizeof(int),1,file)==1
+		&& fwrite(&e->h,sizeof(int),1,file)==1
+		&& fwrite(e->iters,sizeof(int),n,file)==n
+		&& fwrite(e->pixels,sizeof(unsigned int),n,file)==n;
+
+	if(fclose(file)!=0) ok = 0;
+
+	if(!ok || rename(temp,path)!=0) {
+		remove(temp);
+		return 0;
+	}
+
+	e->saved = 1;
+	return 1;
+}
+
+/* Take an entry out of the table and the list, without freeing it. */
+
+static void cache_unlink( struct cache *c, struct cache_entry *e )
+{
+	struct cache_entry **p = &c->buckets[cache_hash(&e->key)%CACHE_BUCKETS];
+	while(*p!=e) p = &(*p)->chain;
+	*p = e->chain;
+
+	if(e->newer) e->newer->older = e->older; else c->newest = e->older;
+	if(e->older) e->older->newer = e->newer; else c->oldest = e->newer;
+
+	c->bytes -= cache_entry_bytes(e->w,e->h);
+}
+
+/* Put an entry at the front of its bucket and at the newest end of the list. */
+
+static void cache_link( struct cache *c, struct cache_entry *e )
+{
+	struct cache_entry **bucket = &c->buckets[cache_hash(&e->key)%CACHE_BUCKETS];
+	e->chain = *bucket;
+	*bucket = e;
+
+	e->newer = 0;
+	e->older = c->newest;
+	if(c->newest) c->newest->newer = e; else c->oldest = e;
+	c->newest = e;
+
+	c->bytes += cache_entry_bytes(e->w,e->h);
+}
+
+/* Drop the oldest entries, saving them first if there is a directory, until there is room for more bytes. */
+
+static void cache_evict( struct cache *c, size_t more )
+{
+	while(c->oldest && c->bytes+more>c->maxbytes) {
+		struct cache_entry *e = c->oldest;
+		if(c->dir && !e->saved) cache_save(c,e);
+		cache_unlink(c,e);
+		free(e);
+	}
+}
+
+/* Allocate an entry for a w x h tile, making room for it first. Return 0 if out of memory or too big to keep. */
+
+static struct cache_entry *cache_alloc( struct cache *c, const struct cache_key *key, int w, int h )
+{
+	size_t bytes = cache_entry_bytes(w,h);
+	if(bytes>c->maxbytes) return 0;
+
+	cache_evict(c,bytes);
+
+	struct cache_entry *e = malloc(bytes);
+	if(!e) return 0;
+
+	e->key = *key;
+	e->w = w;
+	e->h = h;
+	e->saved = 0;
+	e->iters = (int *)(e+1);
+	e->pixels = (unsigned int *)(e->iters+(size_t)w*h);
+	return e;
+}
+
+void cache_delete( struct cache *c )
+{
+	if(!c) return;
+
+	while(c->newest) {
+		struct cache_entry *e = c->newest;
+		if(c->dir && !e->saved) cache_save(c,e);
+		cache_unlink(c,e);
+		free(e);
+	}
+
+	free(c->dir);
+	free(c);
+}
+
+/* Find a key in memory, or failing that in the directory. Return 0 if it is in neither. */
+
+static struct cache_entry *cache_find( struct cache *c, const struct cache_key *key, int w, int h )
+{
+	struct cache_entry *e = c->buckets[cache_hash(key)%CACHE_BUCKETS];
+	while(e && memcmp(&e->key,key,sizeof(*key))) e = e->chain;
+
+	if(e) {
+		if(e->w!=w || e->h!=h) return 0;
+		c->hits++;
+
+		/* Move it to the newest end of the list. */
+		cache_unlink(c,e);
+		cache_link(c,e);
+		return e;
+	}
+
+	if(!c->dir) return 0;
+
+	char path[4096];
+	cache_path(c,key,path,sizeof(path));
+
+	FILE *file = fopen(path,"rb");
+	if(!file) return 0;
+
+	struct cache_key saved;
+	int sw, sh;
+
+	if(fread(&saved,sizeof(saved),1,file)!=1 || memcmp(&saved,key,sizeof(saved))
+		|| fread(&sw,sizeof(int),1,file)!=1 || fread(&sh,sizeof(int),1,file)!=1 || sw!=w || sh!=h) {
+		fclose(file);
+		return 0;
+	}
+
+	e = cache_alloc(c,key,w,h);
+	if(!e) {
+		fclose(file);
+		return 0;
+	}
+
+	size_t n = (size_t)w*h;
+	if(fread(e->iters,sizeof(int),n,file)!=n || fread(e->pixels,sizeof(unsigned int),n,file)!=n) {
+		fclose(file);
+		free(e);
+		return 0;
+	}
+	fclose(file);
+
+	e->saved = 1;
+	cache_link(c,e);
+	c->loads++;
+	return e;
+}
+
+int cache_get( struct cache *c, const struct cache_key *key, int *iters, unsigned int *pixels, int stride, int w, int h )
+{
+	struct cache_entry *e = cache_find(c,key,w,h);
+	if(!e) {
+		c->misses++;
+		return 0;
+	}
+
+	for(int j=0;j<h;j++) {
+		memcpy(&iters[(size_t)j*stride],&e->iters[(size_t)j*w],w*sizeof(int));
+		memcpy(&pixels[(size_t)j*stride],&e->pixels[(size_t)j*w],w*sizeof(unsigned int));
+	}
+
+	return 1;
+}
+
+int cache_put( struct cache *c, const struct cache_key *key, const int *iters, const unsigned int *pixels, int stride, int w, int h )
+{
+	/* Replace any older copy, which is the same tile anyway. */
+	struct cache_entry *old = c->buckets[cache_hash(key)%CACHE_BUCKETS];
+	while(old && memcmp(&old->key,key,sizeof(*key))) old = old->chain;
+	if(old) {
+		cache_unlink(c,old);
+		free(old);
+	}
+
+	struct cache_entry *e = cache_alloc(c,key,w,h);
+	if(!e) return 0;
+
+	for(int j=0;j<h;j++) {
+		memcpy(&e->iters[(size_t)j*w],&iters[(size_t)j*stride],w*sizeof(int));
+		memcpy(&e->pixels[(size_t)j*w],&pixels[(size_t)j*stride],w*sizeof(unsigned int));
+	}
+
+	cache_link(c,e);
+	return 1;
+}
@@ -0,0 +1,90 @@
+/*
+cache.h - A memory bounded cache of finished tiles.
+Each entry is one tile's iteration counts and colors, found by a key
+that says which view, which tile of it, and anything else that changes
+the result.  When the cache is full the least recently used tile goes,
+to a directory if one was given, from which later sessions can load it
+back.  The cache is not thread safe: the renderer only uses it between
+frames.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/* A sensible memory limit for a window-sized frame and plenty of others. */
+#define CACHE_DEFAULT_BYTES (64*1024*1024)
+
+/* Slots in the hash table; entries past this just make the chains longer. */
+#define CACHE_BUCKETS 16384
+
+/* Zero the whole key before filling it in, since it is compared and hashed as bytes. */
+struct cache_key {
+	/* The view, quantized by the caller so that views a rounding error apart match. */
+	long long view[4];
+	int maxiter;
+
+	/* Anything else that changes the counts or colors, such as the mode or palette. */
+	int mode;
+
+	/* The formula, as in struct mandel_formula, with a power of 0 for the Mandelbrot set. */
+	int family;
+	int power;
+	double constant[2];
+
+	/* The size of the whole frame, and where the tile starts in it. */
+	int width;
+	int height;
+	int x;
+	int y;
+};
+
+struct cache_entry {
+	struct cache_key key;
+	int w;
+	int h;
+
+	/* Set once the entry is known to be in the directory too. */
+	int saved;
+
+	/* The next entry in the same bucket, and the neighbors in least recently used order. */
+	struct cache_entry *chain;
+	struct cache_entry *newer;
+	struct cache_entry *older;
+
+	/* w*h counts followed by w*h colors. */
+	int *iters;
+	unsigned int *pixels;
+};
+
+struct cache {
+	size_t bytes;
+	size_t maxbytes;
+
+	/* Where evicted tiles go, or 0 to just drop them. */
+	char *dir;
+
+	struct cache_entry *buckets[CACHE_BUCKETS];
+	struct cache_entry *newest;
+	struct cache_entry *oldest;
+
+	/* Lookups found in memory, found in the directory, and not found. */
+	long hits;
+	long loads;
+	long misses;
+};
+
+/* Create a cache holding up to maxbytes of tiles, spilling to dir if it is not 0. Return 0 on failure. */
+struct cache *cache_create( size_t maxbytes, const char *dir );
+
+/* Save every tile not yet in the directory, if there is one, and free the cache. */
+void cache_delete( struct cache *c );
+
+/* Copy a w x h tile out of the cache into rows stride apart. Return 0 if it is not there. */
+int cache_get( struct cache *c, const struct cache_key *key, int *iters, unsigned int *pixels, int stride, int w, int h );
+
+/* Copy a w x h tile from rows stride apart into the cache. Return 0 if out of memory or too big to keep. */
+int cache_put( struct cache *c, const struct cache_key *key, const int *iters, const unsigned int *pixels, int stride, int w, int h );
+
+#endif
@@ -0,0 +1,141 @@
+/*
+deep.c - Reference orbits for deep zooms.
+
+The reference orbit Z' = Z^2 + C is the only thing iterated in full
+precision, once per view, with GMP floats.  Each Z is rounded to a
+double as it is stored: the pixels only need Z itself to double
+precision, since what they add to it is their own small offset.
+
+The precision has to grow with the zoom, since C needs about as many
+bits as it takes to tell one pixel from the next, plus some to spare
+for the rounding that builds up along the orbit.
+*/
+
+#include "deep.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+/* Bits kept beyond the size of a pixel. */
+#define DEEP_GUARD_BITS 64
+
+void deep_init( struct deep_reference *d, double x, double y )
+{
+	mpf_init2(d->x,DEEP_GUARD_BITS);
+	mpf_init2(d->y,DEEP_GUARD_BITS);
+	mpf_set_d(d->x,x);
+	mpf_set_d(d->y,y);
+
+	d->bits = 0;
+	d->maxiter = 0;
+	d->orbit.length = 0;
+	d->orbit.zr = 0;
+	d->orbit.zi = 0;
+	d->capacity = 0;
+}
+
+void deep_free( struct deep_reference *d )
+{
+	mpf_clear(d->x);
+	mpf_clear(d->y);
+	free(d->orbit.zr);
+	free(d->orbit.zi);
+	d->orbit.zr = 0;
+	d->orbit.zi = 0;
+	d->capacity = 0;
+}
+
+mp_bitcnt_t deep_bits( double pixel )
+{
+	int e;
+	frexp(fabs(pixel),&e);
+
+	return e<0 ? DEEP_GUARD_BITS-e : DEEP_GUARD_BITS;
+}
+
+void deep_move( struct deep_reference *d, double dx, double dy, mp_bitcnt_t bits )
+{
+	mpf_t t;
+
+	/* Make room for the new low bits first; raising the precision keeps the value. */
+	if(mpf_get_prec(d->x)<bits) mpf_set_prec(d->x,bits);
+	if(mpf_get_prec(d->y)<bits) mpf_set_prec(d->y,bits);
+
+	mpf_init2(t,bits);
+	mpf_set_d(t,dx);
+	mpf_add(d->x,d->x,t);
+	mpf_set_d(t,dy);
+	mpf_add(d->y,d->y,t);
+	mpf_clear(t);
+
+	/* The orbit belongs to the old point. */
+	d->bits = 0;
+}
+
+int deep_compute( struct deep_reference *d, int maxiter, mp_bitcnt_t bits )
+{
+	if(maxiter+1>d->capacity) {
+		double *zr = realloc(d->orbit.zr,(maxiter+1)*sizeof(double));
+		if(!zr) return 0;
+		d->orbit.zr = zr;
+
+		double *zi = realloc(d->orbit.zi,(maxiter+1)*sizeof(double));
+		if(!zi) return 0;
+		d->orbit.zi = zi;
+
+		d->capacity = maxiter+1;
+	}
+
+	mpf_t zr, zi, zr2, zi2, t;
+	mpf_init2(zr,bits);
+	mpf_init2(zi,bits);
+	mpf_init2(zr2,bits);
+	mpf_init2(zi2,bits);
+	mpf_init2(t,bits);
+
+	d->orbit.zr[0] = 0;
+	d->orbit.zi[0] = 0;
+
+	int n = 0;
+	while(n<maxiter) {
+		mpf_mul(zr2,zr,zr);
+		mpf_mul(zi2,zi,zi);
+
+		// zi = 2*zr*zi + y
+		mpf_mul(t,zr,zi);
+		mpf_mul_2exp(t,t,1);
+		mpf_add(zi,t,d->y);
+
+		// zr = zr^2 - zi^2 + x
+		mpf_sub(t,zr2,zi2);
+		mpf_add(zr,t,d->x);
+
+		n++;
+		d->orbit.zr[n] = mpf_get_d(zr);
+		d->orbit.zi[n] = mpf_get_d(zi);
+
+		/* Once the reference escapes, the pixels rebase onto the start instead of following it. */
+		if(d->orbit.zr[n]*d->orbit.zr[n] + d->orbit.zi[n]*d->orbit.zi[n] >= 16) break;
+	}
+
+	mpf_clear(t);
+	mpf_clear(zi2);
+	mpf_clear(zr2);
+	mpf_clear(zi);
+	mpf_clear(zr);
+
+	d->orbit.length = n;
+	d->bits = bits;
+	d->maxiter = maxiter;
+
+	return 1;
+}
+
+void deep_print( const struct deep_reference *d )
+{
+	/* A decimal digit is worth about 3.32 bits. */
+	int digits = (int)(mpf_get_prec(d->x)/3.32)+1;
+
+	gmp_printf("reference: %.*Fg %.*Fg\n",digits,d->x,digits,d->y);
+}
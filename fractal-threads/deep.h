@@ -0,0 +1,48 @@
+/*
+deep.h - Reference orbits for deep zooms.
+Once the view is narrower than about 1e-13, doubles can no longer tell
+neighboring pixels apart.  A deep zoom keeps the reference point in as
+many bits as it takes, computes one orbit there with GMP, and lets every
+pixel iterate only its offset from it (see mandel_points_perturbed).
+*/
+
+#ifndef DEEP_H
+#define DEEP_H
+
+#include <gmp.h>
+
+#include "mandel.h"
+
+struct deep_reference {
+	/* The reference point, which views are drawn relative to. */
+	mpf_t x;
+	mpf_t y;
+
+	/* The precision and the iteration limit the orbit was last computed with. */
+	mp_bitcnt_t bits;
+	int maxiter;
+
+	/* The orbit itself, rounded to doubles. */
+	struct mandel_orbit orbit;
+	int capacity;
+};
+
+/* Start with the reference at x+iy and no orbit yet. */
+void deep_init( struct deep_reference *d, double x, double y );
+
+/* Release the reference point and the orbit. */
+void deep_free( struct deep_reference *d );
+
+/* Return how many bits the reference needs for a view whose pixels are this far apart. */
+mp_bitcnt_t deep_bits( double pixel );
+
+/* Move the reference point by dx+i*dy, keeping at least bits of precision. */
+void deep_move( struct deep_reference *d, double dx, double dy, mp_bitcnt_t bits );
+
+/* Compute the orbit at the reference point with bits of precision, up to maxiter. Return 0 if out of memory. */
+int deep_compute( struct deep_reference *d, int maxiter, mp_bitcnt_t bits );
+
+/* Print the reference point with enough digits to find it again. */
+void deep_print( const struct deep_reference *d );
+
+#endif
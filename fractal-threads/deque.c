@@ -0,0 +1,92 @@
+/*
+deque.c - A fixed size work stealing deque of integers.
+
+This follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+by Le, Pop, Cohen and Zappa Nardelli, using the GCC atomic builtins.
+The only contended case is when the owner and a thief both go for
+the last item, and that is settled with a compare and swap on top.
+*/
+
+#include "deque.h"
+
+#include <stdlib.h>
+
+int deque_init( struct deque *d, int capacity )
+{
+	long size = 1;
+
+	while(size<capacity) size *= 2;
+
+	d->items = malloc(sizeof(int)*size);
+	if(!d->items) return 0;
+
+	d->mask = size-1;
+	d->top = 0;
+	d->bottom = 0;
+	return 1;
+}
+
+void deque_free( struct deque *d )
+{
+	free(d->items);
+	d->items = 0;
+}
+
+void deque_reset( struct deque *d )
+{
+	__atomic_store_n(&d->top,0,__ATOMIC_SEQ_CST);
+	__atomic_store_n(&d->bottom,0,__ATOMIC_SEQ_CST);
+}
+
+int deque_push( struct deque *d, int item )
+{
+	long b = __atomic_load_n(&d->bottom,__ATOMIC_RELAXED);
+	long t = __atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+
+	if(b-t>d->mask) return 0;
+
+	__atomic_store_n(&d->items[b&d->mask],item,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+	return 1;
+}
+
+int deque_pop( struct deque *d, int *item )
+{
+	long b = __atomic_load_n(&d->bottom,__ATOMIC_RELAXED)-1;
+	__atomic_store_n(&d->bottom,b,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&d->top,__ATOMIC_RELAXED);
+
+	if(t>b) {
+		/* Already empty, put bottom back where it was. */
+		__atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+		return 0;
+	}
+
+	*item = __atomic_load_n(&d->items[b&d->mask],__ATOMIC_RELAXED);
+
+	if(t==b) {
+		/* This is the last item, so race any thieves for it. */
+		int won = __atomic_compare_exchange_n(&d->top,&t,t+1,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED);
+		__atomic_store_n(&d->bottom,b+1,__ATOMIC_RELAXED);
+		return won;
+	}
+
+	return 1;
+}
+
+int deque_steal( struct deque *d, int *item )
+{
+	long t = __atomic_load_n(&d->top,__ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&d->bottom,__ATOMIC_ACQUIRE);
+
+	if(t>=b) return 0;
+
+	int x = __atomic_load_n(&d->items[t&d->mask],__ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&d->top,&t,t+1,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED)) return 0;
+
+	*item = x;
+	return 1;
+}
@@ -0,0 +1,35 @@
+/*
+deque.h - A fixed size work stealing deque of integers (Chase-Lev).
+The owning thread pushes and pops at the bottom, while any other
+thread may steal from the top at the same time without a lock.
+*/
+
+#ifndef DEQUE_H
+#define DEQUE_H
+
+struct deque {
+	long top;
+	long bottom;
+	long mask;
+	int *items;
+};
+
+/* Make room for at least capacity items. Return 0 if out of memory. */
+int deque_init( struct deque *d, int capacity );
+
+/* Release the memory held by the deque. */
+void deque_free( struct deque *d );
+
+/* Empty the deque. Only call this while no other thread is using it. */
+void deque_reset( struct deque *d );
+
+/* Owner only: push an item on the bottom. Return 0 if the deque is full. */
+int deque_push( struct deque *d, int item );
+
+/* Owner only: pop the most recently pushed item. Return 0 if the deque is empty. */
+int deque_pop( struct deque *d, int *item );
+
+/* Any thread: take the oldest item. Return 0 if the deque is empty or another thread got there first. */
+int deque_steal( struct deque *d, int *item );
+
+#endif
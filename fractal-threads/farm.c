@@ -0,0 +1,382 @@
+/*
+farm.c - Rendering a frame across several processes.
+
+The coordinator keeps one tile out with each worker at a time and waits
+in poll for the next result, a new worker, or a dead one.  A worker that
+closes its socket or sends back something that does not match its tile
+is dropped, and the tile it had goes back on the waiting list.  So is a
+worker that has not sent its tile back by the deadline, which is what a
+hung one looks like from here.  Each time a tile is taken back that way
+its deadline doubles, so a tile that is just slow still gets done.
+
+Everything is on one host, so jobs and results go over the socket as
+plain structs.  Counts are sent as 16 bit numbers whenever maxiter fits,
+which halves what goes over the socket for most views.  The workers use
+render_region, so a tile comes back exactly as a single renderer of the
+whole frame would have drawn it.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "farm.h"
+#include "mandel.h"
+#include "sock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define FARM_WAITING 0
+#define FARM_RUNNING 1
+#define FARM_DONE 2
+
+/* Milliseconds on the monotonic clock. */
+
+static long long farm_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+struct farm *farm_create( const char *path, int width, int height, int maxworkers )
+{
+	struct farm *f = calloc(1,sizeof(*f));
+	if(!f) return 0;
+
+	if(strlen(path)>=sizeof(f->path)) {
+		free(f);
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+
+	strcpy(f->path,path);
+	f->width = width;
+	f->height = height;
+	f->maxworkers = maxworkers;
+	f->listener = -1;
+
+	int tw = (width+FARM_TILE_SIZE-1)/FARM_TILE_SIZE;
+	int th = (height+FARM_TILE_SIZE-1)/FARM_TILE_SIZE;
+
+	f->iters = calloc(width*height,sizeof(int));
+	f->workers = calloc(maxworkers,sizeof(struct farm_worker));
+	f->children = calloc(maxworkers,sizeof(pid_t));
+	f->jobs = calloc(tw*th,sizeof(struct farm_job));
+	f->state = calloc(tw*th,sizeof(int));
+	f->late = calloc(tw*th,sizeof(int));
+
+	if(!f->iters || !f->workers || !f->children || !f->jobs || !f->state || !f->late) {
+		farm_delete(f);
+		return 0;
+	}
+
+	f->listener = sock_listen(path,maxworkers);
+	if(f->listener<0) {
+		farm_delete(f);
+		return 0;
+	}
+
+	return f;
+}
+
+void farm_delete( struct farm *f )
+{
+	if(!f) return;
+
+	for(int k=0;k<f->nworkers;k++) close(f->workers[k].fd);
+
+	if(f->listener>=0) {
+		close(f->listener);
+		unlink(f->path);
+	}
+
+	/*
+	With the sockets closed, every worker's next read fails and it exits.
+	One that hung never gets that far, and none has work left worth
+	finishing, so end them all.
+	*/
+	for(int k=0;k<f->nchildren;k++) {
+		kill(f->children[k],SIGTERM);
+		waitpid(f->children[k],NULL,0);
+	}
+
+	free(f->late);
+	free(f->state);
+	free(f->jobs);
+	free(f->children);
+	free(f->workers);
+	free(f->iters);
+	free(f);
+}
+
+int farm_spawn( struct farm *f, int nthreads )
+{
+	if(f->nchildren>=f->maxworkers) {
+		errno = EAGAIN;
+		return 0;
+	}
+
+	pid_t pid = fork();
+	if(pid<0) return 0;
+
+	if(pid==0) {
+		/* The child keeps none of the coordinator's sockets, so they close when the coordinator does. */
+		close(f->listener);
+		for(int k=0;k<f->nworkers;k++) close(f->workers[k].fd);
+		_exit(farm_worker(f->path,nthreads) ? 0 : 1);
+	}
+
+	f->children[f->nchildren++] = pid;
+	return 1;
+}
+
+/* Take a worker out of the farm, and put back the tile it was working on. */
+
+static void farm_drop( struct farm *f, int k )
+{
+	struct farm_worker *w = &f->workers[k];
+
+	close(w->fd);
+	if(w->job>=0) {
+		f->state[w->job] = FARM_WAITING;
+		f->reassigned++;
+	}
+
+	f->workers[k] = f->workers[--f->nworkers];
+}
+
+/* Accept a worker that is waiting to connect, if there is room for it. */
+
+static void farm_accept( struct farm *f )
+{
+	int fd = accept(f->listener,NULL,NULL);
+	if(fd<0) return;
+
+	if(f->nworkers>=f->maxworkers) {
+		close(fd);
+		return;
+	}
+
+	/* A worker that stops halfway through sending a tile gives up the read instead of holding up the frame. */
+	struct timeval limit = { FARM_DEADLINE/1000, FARM_DEADLINE%1000*1000 };
+	setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&limit,sizeof(limit));
+
+	f->workers[f->nworkers].fd = fd;
+	f->workers[f->nworkers].job = -1;
+	f->nworkers++;
+}
+
+/* Read worker k's result into iters. Return 0 if it died or sent back the wrong tile. */
+
+static int farm_collect( struct farm *f, int k )
+{
+	struct farm_worker *w = &f->workers[k];
+	struct farm_result res;
+
+	if(w->job<0) return 0;
+
+	const struct farm_job *job = &f->jobs[w->job];
+
+	if(!sock_read_full(w->fd,&res,sizeof(res))) return 0;
+	if(res.x!=job->x || res.y!=job->y || res.w!=job->w || res.h!=job->h) return 0;
+	if(res.size!=sizeof(uint16_t) && res.size!=sizeof(int32_t)) return 0;
+
+	int n = res.w*res.h;
+	void *data = malloc(n*res.size);
+	if(!data || !sock_read_full(w->fd,data,n*res.size)) {
+		free(data);
+		return 0;
+	}
+
+	for(int j=0;j<res.h;j++) {
+		int *iters = &f->iters[(res.y+j)*f->width+res.x];
+		for(int i=0;i<res.w;i++) {
+			int p = j*res.w+i;
+			iters[i] = res.size==sizeof(uint16_t) ? ((uint16_t*)data)[p] : ((int32_t*)data)[p];
+		}
+	}
+
+	free(data);
+	return 1;
+}
+
+int farm_render( struct farm *f, const struct render_view *view )
+{
+	int njobs = 0;
+	int done = 0;
+
+	for(int y=0;y<f->height;y+=FARM_TILE_SIZE) {
+		for(int x=0;x<f->width;x+=FARM_TILE_SIZE) {
+			struct farm_job *job = &f->jobs[njobs];
+
+			job->xmin = view->xmin;
+			job->xmax = view->xmax;
+			job->ymin = view->ymin;
+			job->ymax = view->ymax;
+			job->maxiter = view->maxiter;
+			job->accelerated = mandel_accelerated();
+			job->frame_width = f->width;
+			job->frame_height = f->height;
+			job->x = x;
+			job->y = y;
+			job->w = f->width-x<FARM_TILE_SIZE ? f->width-x : FARM_TILE_SIZE;
+			job->h = f->height-y<FARM_TILE_SIZE ? f->height-y : FARM_TILE_SIZE;
+
+			f->late[njobs] = 0;
+			f->state[njobs++] = FARM_WAITING;
+		}
+	}
+
+	f->njobs = njobs;
+	f->reassigned = 0;
+
+	int next = 0;
+
+	while(done<njobs) {
+		/* Hand a waiting tile to every idle worker. */
+		for(int k=f->nworkers-1;k>=0;k--) {
+			if(f->workers[k].job>=0) continue;
+
+			int t = -1;
+			for(int c=0;c<njobs && t<0;c++) {
+				int j = (next+c)%njobs;
+				if(f->state[j]==FARM_WAITING) t = j;
+			}
+			if(t<0) break;
+			next = t+1;
+
+			if(!sock_write_full(f->workers[k].fd,&f->jobs[t],sizeof(struct farm_job))) {
+				farm_drop(f,k);
+				continue;
+			}
+			f->state[t] = FARM_RUNNING;
+			f->workers[k].job = t;
+			f->workers[k].deadline = farm_clock() + ((long long)FARM_DEADLINE << (f->late[t]<16 ? f->late[t] : 16));
+		}
+
+		struct pollfd fds[f->nworkers+1];
+		fds[0].fd = f->listener;
+		fds[0].events = POLLIN;
+		for(int k=0;k<f->nworkers;k++) {
+			fds[k+1].fd = f->workers[k].fd;
+			fds[k+1].events = POLLIN;
+		}
+
+		/* Waiting for workers to show up only goes on so long, and waiting for a tile until its deadline. */
+		int timeout = f->nworkers ? -1 : FARM_TIMEOUT;
+		long long now = farm_clock();
+		for(int k=0;k<f->nworkers;k++) {
+			if(f->workers[k].job<0) continue;
+			long long left = f->workers[k].deadline - now;
+			if(left<0) left = 0;
+			if(timeout<0 || left<timeout) timeout = left;
+		}
+
+		int n = poll(fds,f->nworkers+1,timeout);
+		if(n<0 && errno==EINTR) continue;
+		if(n<0) return 0;
+		if(n==0 && !f->nworkers) {
+			errno = ETIMEDOUT;
+			return 0;
+		}
+
+		/*
+		Go backwards, so a dropped worker is replaced by one already handled.
+		A worker with nothing to say that is still on its tile past the
+		deadline has hung, so its tile goes to another.
+		*/
+		now = farm_clock();
+		for(int k=f->nworkers-1;k>=0;k--) {
+			if(!fds[k+1].revents) {
+				int t = f->workers[k].job;
+				if(t>=0 && now>=f->workers[k].deadline) {
+					f->late[t]++;
+					farm_drop(f,k);
+				}
+				continue;
+			}
+
+			if(!farm_collect(f,k)) {
+				farm_drop(f,k);
+				continue;
+			}
+
+			f->state[f->workers[k].job] = FARM_DONE;
+			f->workers[k].job = -1;
+			done++;
+		}
+
+		if(fds[0].revents & POLLIN) farm_accept(f);
+	}
+
+	return 1;
+}
+
+int farm_worker( const char *path, int nthreads )
+{
+	int fd = sock_connect(path);
+	if(fd<0) return 0;
+
+	struct render *r = render_create(FARM_TILE_SIZE,FARM_TILE_SIZE,nthreads);
+	void *data = malloc(FARM_TILE_SIZE*FARM_TILE_SIZE*sizeof(int32_t));
+	if(!r || !data) {
+		render_delete(r);
+		free(data);
+		close(fd);
+		return 0;
+	}
+
+	struct farm_job job;
+
+	while(sock_read_full(fd,&job,sizeof(job))) {
+		if(job.w<1 || job.h<1 || job.w>FARM_TILE_SIZE || job.h>FARM_TILE_SIZE) break;
+
+		struct render_view view;
+		view.xmin = job.xmin;
+		view.xmax = job.xmax;
+		view.ymin = job.ymin;
+		view.ymax = job.ymax;
+		view.maxiter = job.maxiter;
+		view.orbit = 0;
+		view.formula = 0;
+
+		/* No frame is running here between tiles, so this is a safe time to switch. */
+		mandel_set_accelerated(job.accelerated);
+
+		render_region(r,&view,job.frame_width,job.frame_height,job.x,job.y,job.w,job.h,nthreads);
+
+		struct farm_result res;
+		res.x = job.x;
+		res.y = job.y;
+		res.w = job.w;
+		res.h = job.h;
+		res.size = job.maxiter<65536 ? sizeof(uint16_t) : sizeof(int32_t);
+
+		for(int j=0;j<job.h;j++) {
+			const int *iters = &r->iters[j*r->width];
+			for(int i=0;i<job.w;i++) {
+				int p = j*job.w+i;
+				if(res.size==sizeof(uint16_t)) ((uint16_t*)data)[p] = iters[i];
+				else ((int32_t*)data)[p] = iters[i];
+			}
+		}
+
+		if(!sock_write_full(fd,&res,sizeof(res)) || !sock_write_full(fd,data,job.w*job.h*res.size)) break;
+	}
+
+	free(data);
+	render_delete(r);
+	close(fd);
+
+	return 1;
+}
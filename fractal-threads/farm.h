@@ -0,0 +1,115 @@
+/*
+farm.h - Rendering a frame across several processes.
+A coordinator listens on a Unix domain socket and cuts each frame into
+tiles.  Worker processes connect to it, take one tile at a time, compute
+it with their own threaded renderer, and send back the iteration counts.
+Workers can be forked by the coordinator or started on their own, from
+anywhere that can reach the socket, and can join at any time.  If a
+worker dies before sending its tile back, or takes too long over it,
+the tile goes to another one.
+*/
+
+#ifndef FARM_H
+#define FARM_H
+
+#include <sys/types.h>
+
+#include "render.h"
+
+/* Side length of the tiles a frame is cut into for the workers. */
+#define FARM_TILE_SIZE 128
+
+/* How long a frame waits with no workers at all before giving up, in milliseconds. */
+#define FARM_TIMEOUT 5000
+
+/* How long a worker may spend on a tile before it is taken to have hung, in milliseconds. Doubles each time the tile is taken back. */
+#define FARM_DEADLINE 30000
+
+/* One tile of a frame, as sent to a worker. */
+struct farm_job {
+	double xmin;
+	double xmax;
+	double ymin;
+	double ymax;
+	int maxiter;
+	int accelerated;
+
+	/* The size of the whole frame, and the tile's place in it. */
+	int frame_width;
+	int frame_height;
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+/* What a worker sends back, followed by w*h counts of size bytes each, row by row. */
+struct farm_result {
+	int x;
+	int y;
+	int w;
+	int h;
+	int size;
+};
+
+struct farm_worker {
+	int fd;
+
+	/* The index of the tile this worker is computing, or -1 if it is idle. */
+	int job;
+
+	/* When the tile must be back by, in milliseconds on the monotonic clock. */
+	long long deadline;
+};
+
+struct farm {
+	int listener;
+	char path[108];
+
+	int width;
+	int height;
+
+	/* The iteration count of every pixel of the last frame, row by row. */
+	int *iters;
+
+	/* The connected workers; a dead one is taken out of the list. */
+	int nworkers;
+	int maxworkers;
+	struct farm_worker *workers;
+
+	/* The forked workers, to be waited for at the end. */
+	int nchildren;
+	pid_t *children;
+
+	/* This frame's tiles and whether each one is waiting, out with a worker, or done. */
+	int njobs;
+	struct farm_job *jobs;
+	int *state;
+
+	/* How many times each tile of this frame was taken back from a worker that took too long. */
+	int *late;
+
+	/* Tiles that had to be given to another worker during the last frame, because one died or hung. */
+	int reassigned;
+};
+
+/* Listen on the socket at path for up to maxworkers workers, to draw width x height frames. Return 0 on failure. */
+struct farm *farm_create( const char *path, int width, int height, int maxworkers );
+
+/* Close the socket, which makes every worker exit, end and wait for the forked ones, and free the farm. */
+void farm_delete( struct farm *f );
+
+/* Fork a worker process with nthreads threads that connects to the farm. Return 0 on failure. */
+int farm_spawn( struct farm *f, int nthreads );
+
+/*
+Compute the view with the workers, filling in iters.  Deep zoom orbits
+are not sent, so the view must not have one.  Return 0 if every worker
+died or none came within FARM_TIMEOUT, leaving iters partly drawn.
+*/
+int farm_render( struct farm *f, const struct render_view *view );
+
+/* Connect to the farm at path and compute tiles with nthreads threads until it closes. Return 0 if it could not connect. */
+int farm_worker( const char *path, int nthreads );
+
+#endif
@@ -4,46 +4,44 @@ Starting code for CSE 30341 Project 3.
 */
 
 #include "gfx.h"
+#include "mandel.h"
+#include "palette.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
-#include <complex.h>
 
-/*
-Compute the number of iterations at point x, y
-in the complex space, up to a maximum of maxiter.
-Return the number of iterations at that point.
-
-This example computes the Mandelbrot fractal:
-z = z^2 + alpha
-
-Where z is initially zero, and alpha is the location x + iy
-in the complex plane.  Note that we are using the "complex"
-numeric type in C, which has the special functions cabs()
-and cpow() to compute the absolute values and powers of
-complex values.
-*/
-
-static int compute_point( double x, double y, int max )
-{
-	double complex z = 0;
-	double complex alpha = x + I*y;
-
-	int iter = 0;
-
-	while( cabs(z)<4 && iter < max ) {
-		z = cpow(z,2) + alpha;
-		iter++;
-	}
-
-	return iter;
+//Framebuffer the image is drawn into before it is sent to the window
+unsigned int *framebuffer = 0;
+int fbWidth = 0;
+int fbHeight = 0;
+
+//Colors for every iteration count, redone only when maxiter changes
+struct palette palette;
+
+//Set by -g to color with a gradient instead of gray
+int scheme = PALETTE_GRAY;
+
+//Make sure the framebuffer matches the window size
+void resizeFramebuffer(int width, int height){
+    if(width == fbWidth && height == fbHeight) return;
+
+    free(framebuffer);
+    framebuffer = calloc(width*height, sizeof(unsigned int));
+    if(!framebuffer){
+        fprintf(stderr, "fractal: unable to allocate framebuffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    fbWidth = width;
+    fbHeight = height;
 }
 
+
 /*
-Compute an entire image, writing each point to the given bitmap.
+Compute an entire image, writing each point to the framebuffer,
+then send the whole framebuffer to the window at once.
 Scale the image to the range (xmin-xmax,ymin-ymax).
 */
 
@@ -53,29 +51,34 @@ void compute_image(double xmin, double xmax, double ymin, double ymax, int maxit
 
     int width = gfx_xsize();
 	int height = gfx_ysize();
-    
-	// For every pixel i,j, in the image...
 
-	for(j=0;j<height;j++) {
-		for(i=0;i<width;i++) {
+    resizeFramebuffer(width, height);
+
+    //Work out the colors once for this maxiter, rather than for every pixel
+    if(!palette_update(&palette, scheme, maxiter)){
+        fprintf(stderr, "fractal: unable to allocate palette: %s\n", strerror(errno));
+        exit(1);
+    }
+
+	// For every pixel i,j, in the image...
 
-			// Scale from pixels i,j to coordinates x,y
-			double x = xmin + i*(xmax-xmin)/width;
-			double y = ymin + j*(ymax-ymin)/height;
+	int iters[width];
 
-			// Compute the iterations at x,y
-			int iter = compute_point(x,y,maxiter);
+	for(j=0;j<height;j++) {
+		// Scale from row j to coordinate y
+		double y = ymin + j*(ymax-ymin)/height;
 
-			// Convert a iteration number to an RGB color.
-			// (Change this bit to get more interesting colors.)
-			int grey = 255 * iter / maxiter;
-            //Color scheme
-			gfx_color(grey,grey,grey);
+		// Compute the iterations for every x,y in the row at once
+		mandel_row(xmin,xmax,width,0,width,y,maxiter,iters);
 
-			// Plot the point on the screen.
-			gfx_point(i,j);
+		for(i=0;i<width;i++) {
+			// Look up the color of the iteration number.
+			framebuffer[j*width+i] = palette_color(&palette,iters[i]);
 		}
 	}
+
+	// Plot the whole image on the screen.
+	gfx_put_image(framebuffer,width,height);
 }
 
 int main( int argc, char *argv[] )
@@ -91,11 +94,24 @@ int main( int argc, char *argv[] )
 	// Higher values take longer but have more detail.
 	int maxiter=500;
 
+	// Pick the fastest kernel for this machine.
+	mandel_init();
+
+	palette_init(&palette);
+
+	// -a skips the inside of the set: cardioid and bulb checks plus cycle detection.
+	// -g colors with a gradient instead of gray.
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+		else if(!strcmp(argv[i], "-g")) scheme = PALETTE_GRADIENT;
+	}
+
 	// Open a new window.
 	gfx_open(640,480,"Mandelbrot Fractal");
 
 	// Show the configuration, just in case you want to recreate it.
 	printf("coordinates: %lf %lf %lf %lf\n",xmin,xmax,ymin,ymax);
+	printf("kernel: %s%s\n",mandel_kernel_name(),mandel_accelerated() ? " (accelerated)" : "");
 
 	// Fill it with a dark blue initially.
 	gfx_clear_color(0,0,255);
@@ -108,7 +124,6 @@ int main( int argc, char *argv[] )
 	while(1) {
 		// Wait for a key or mouse click.
         int c = gfx_wait();
-        gfx_clear();
   
         switch(c){
             case '=':       //Zoom Out
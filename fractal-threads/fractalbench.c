@@ -0,0 +1,229 @@
+/*
+fractalbench.c - Headless Mandelbrot benchmark.
+Renders a fixed set of views with each of the ways the other programs
+split up the work, at 1 to N threads, and prints one CSV line per run.
+No window is opened, so it runs anywhere and the numbers can be compared
+from one build to the next.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mandel.h"
+#include "pool.h"
+#include "render.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+//A view the benchmark always renders, so runs can be compared
+struct bench_view{
+    const char *name;
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+    int maxiter;
+};
+
+struct bench_view views[] = {
+    { "default",    -1.5,    0.5,    -1.0,   1.0,   500 },   //The view the programs start with
+    { "seahorse",   -0.75,  -0.74,    0.105, 0.115, 1000 },  //Seahorse valley, almost all boundary
+    { "interior",   -0.4,   -0.1,    -0.15,  0.15,  2000 },  //Inside the cardioid, every pixel hits maxiter
+    { "highiter",   -0.7454, -0.7452, 0.1130, 0.1132, 10000 },//Deep in the seahorses with a high limit
+};
+
+#define NUM_VIEWS (int)(sizeof(views)/sizeof(views[0]))
+
+//The ways of splitting up a frame: one row at a time like fractal,
+//equal bands like fractalthread, and tiles or subdivision like fractaltask
+const char *modes[] = { "serial", "bands", "tiles", "subdivide" };
+
+#define NUM_MODES (int)(sizeof(modes)/sizeof(modes[0]))
+
+//Image size and iteration counts, shared by every mode
+int width = 640;
+int height = 480;
+int *iters = 0;
+
+//Seconds each thread spent computing in the last run
+double *busy = 0;
+
+//Threads for the bands mode, and the renderer for the tile modes
+struct pool *pool = 0;
+struct render *renderer = 0;
+
+//The view the band threads are working on
+struct bench_view *bandView = 0;
+int bandCount = 0;
+
+//Current time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Compute rows sH to eH-1 of the view into iters
+void computeRows(struct bench_view *v, int sH, int eH){
+    for(int j = sH; j < eH; j++){
+        double y = v->ymin + j*(v->ymax-v->ymin)/height;
+        mandel_row(v->xmin, v->xmax, width, 0, width, y, v->maxiter, &iters[j*width]);
+    }
+}
+
+//Thread body for the bands mode: one equal band of rows per thread, covering every row
+void computeBand(int id, void *arg){
+    (void)arg;
+    double start = now();
+    computeRows(bandView, id*height/bandCount, (id+1)*height/bandCount);
+    busy[id] = now() - start;
+}
+
+//Render the view once in the given mode, and return how long it took
+double runMode(int mode, struct bench_view *v, int threads){
+    struct render_view rv;
+    rv.xmin = v->xmin;
+    rv.xmax = v->xmax;
+    rv.ymin = v->ymin;
+    rv.ymax = v->ymax;
+    rv.maxiter = v->maxiter;
+    rv.orbit = 0;
+    rv.formula = 0;
+
+    double start = now();
+
+    if(mode == 0){
+        computeRows(v, 0, height);
+        busy[0] = now() - start;
+    }else if(mode == 1){
+        bandView = v;
+        bandCount = threads;
+        pool_run(pool, threads, computeBand, 0);
+    }else{
+        renderer->subdivide = mode == 3;
+        render_image(renderer, &rv, threads);
+    }
+
+    double elapsed = now() - start;
+
+    //The tile modes keep their own counts and timings
+    if(mode >= 2){
+        memcpy(iters, renderer->iters, width*height*sizeof(int));
+        memcpy(busy, renderer->busy, threads*sizeof(double));
+    }
+
+    return elapsed;
+}
+
+//Print how to run the benchmark
+void usage(){
+    fprintf(stderr, "use: fractalbench [-a] [-c] [-j threads] [-w width] [-h height] [-r repeats] [-T tracefile]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    int maxThreads = pool_cpus();
+    int repeats = 3;
+    int pin = 0;
+    const char *traceFile = 0;
+    struct trace *trace = 0;
+
+    mandel_init();
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc) maxThreads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-w") && i+1 < argc) width = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-h") && i+1 < argc) height = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-r") && i+1 < argc) repeats = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-c")) pin = 1;
+        else if(!strcmp(argv[i], "-T") && i+1 < argc) traceFile = argv[++i];
+        else usage();
+    }
+    if(maxThreads < 1 || width < 1 || height < 1 || repeats < 1) usage();
+
+    iters = malloc(width*height*sizeof(int));
+    busy = calloc(maxThreads, sizeof(double));
+    pool = pool_create(maxThreads);
+    renderer = render_create(width, height, maxThreads);
+    if(!iters || !busy || !pool || !renderer){
+        fprintf(stderr, "fractalbench: unable to start: %s\n", strerror(errno));
+        exit(1);
+    }
+    //Only the tile modes are traced, since they are the ones that hand out work as they go
+    if(traceFile){
+        trace = trace_create(maxThreads);
+        if(!trace){
+            fprintf(stderr, "fractalbench: unable to allocate trace: %s\n", strerror(errno));
+            exit(1);
+        }
+        renderer->trace = trace;
+    }
+    if(pin && (!pool_pin(pool) || !pool_pin(renderer->pool))){
+        fprintf(stderr, "fractalbench: unable to pin threads: %s\n", strerror(errno));
+    }
+
+    //The kernel goes to stderr so the CSV on stdout stays clean
+    fprintf(stderr, "kernel: %s%s\n", mandel_kernel_name(), mandel_accelerated() ? " (accelerated)" : "");
+
+    printf("mode,view,threads,width,height,maxiter,seconds,mpixels_per_s,iters_per_s,speedup,busy_mean,busy_max,imbalance,busy\n");
+
+    for(int m = 0; m < NUM_MODES; m++){
+        for(int v = 0; v < NUM_VIEWS; v++){
+            double base = 0;
+
+            //Serial is one thread by definition
+            int top = m == 0 ? 1 : maxThreads;
+
+            for(int n = 1; n <= top; n++){
+                double best = 0;
+                double bestBusy[n];
+
+                //Keep the fastest of the repeats, which is the least disturbed by anything else running
+                for(int r = 0; r < repeats; r++){
+                    for(int t = 0; t < n; t++) busy[t] = 0;
+                    double elapsed = runMode(m, &views[v], n);
+                    if(r == 0 || elapsed < best){
+                        best = elapsed;
+                        memcpy(bestBusy, busy, n*sizeof(double));
+                    }
+                }
+                if(n == 1) base = best;
+
+                //Iterations here are the sum of the counts, so modes that skip pixels get credit for them
+                double total = 0;
+                for(int k = 0; k < width*height; k++) total += iters[k];
+
+                //Imbalance is how much longer the busiest thread worked than the average one
+                double sum = 0;
+                double most = 0;
+                for(int t = 0; t < n; t++){
+                    sum += bestBusy[t];
+                    if(bestBusy[t] > most) most = bestBusy[t];
+                }
+                double mean = sum/n;
+
+                printf("%s,%s,%d,%d,%d,%d,%.6f,%.3f,%.4g,%.2f,%.6f,%.6f,%.3f,",
+                    modes[m], views[v].name, n, width, height, views[v].maxiter, best,
+                    width*height/best/1e6, total/best, base/best, mean, most, mean > 0 ? most/mean : 0);
+                for(int t = 0; t < n; t++) printf("%s%.6f", t ? ";" : "", bestBusy[t]);
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+
+    if(trace && !trace_save(trace, traceFile)){
+        fprintf(stderr, "fractalbench: unable to write %s: %s\n", traceFile, strerror(errno));
+    }
+
+    render_delete(renderer);
+    trace_delete(trace);
+    pool_delete(pool);
+    free(busy);
+    free(iters);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+fractalfarm.c - Mandelbrot frames rendered by a farm of worker processes.
+The coordinator forks the workers, or waits for ones started elsewhere
+with -worker, and hands each of them tiles over a Unix domain socket.
+Each worker computes its tiles with the threaded renderer.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mandel.h"
+#include "pool.h"
+#include "farm.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//Current time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Write the frame as a gray PGM image, shaded the same way the other programs are
+int writeImage(const char *name, struct farm *f, int maxiter){
+    FILE *file = fopen(name, "wb");
+    if(!file) return 0;
+
+    fprintf(file, "P5\n%d %d\n255\n", f->width, f->height);
+    for(int k = 0; k < f->width*f->height; k++){
+        fputc(255 * f->iters[k] / maxiter, file);
+    }
+
+    return fclose(file) == 0;
+}
+
+//Print how to run the farm
+void usage(){
+    fprintf(stderr, "use: fractalfarm [-a] [-n workers] [-j threads] [-w width] [-h height] [-m maxiter] [-r frames] [-s socket] [-o image.pgm]\n");
+    fprintf(stderr, "     fractalfarm -worker socket [-j threads]\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    //The same view the other programs start with
+    double xmin = -1.5;
+    double xmax = 0.5;
+    double ymin = -1.0;
+    double ymax = 1.0;
+    int maxiter = 500;
+
+    int width = 640;
+    int height = 480;
+    int workers = 2;
+    int threads = 0;
+    int frames = 1;
+    const char *worker = 0;
+    const char *output = 0;
+    char path[108];
+
+    snprintf(path, sizeof(path), "/tmp/fractalfarm.%d", (int)getpid());
+
+    mandel_init();
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+        else if(!strcmp(argv[i], "-worker") && i+1 < argc) worker = argv[++i];
+        else if(!strcmp(argv[i], "-n") && i+1 < argc) workers = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-w") && i+1 < argc) width = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-h") && i+1 < argc) height = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-m") && i+1 < argc) maxiter = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-r") && i+1 < argc) frames = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-s") && i+1 < argc) snprintf(path, sizeof(path), "%s", argv[++i]);
+        else if(!strcmp(argv[i], "-o") && i+1 < argc) output = argv[++i];
+        else usage();
+    }
+
+    //A worker started by hand uses every core unless told otherwise
+    if(worker){
+        if(!farm_worker(worker, threads > 0 ? threads : pool_cpus())){
+            fprintf(stderr, "fractalfarm: unable to join %s: %s\n", worker, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    if(workers < 0 || width < 1 || height < 1 || maxiter < 1 || frames < 1) usage();
+
+    //Share the cores out between the forked workers
+    if(threads < 1) threads = workers > 0 && pool_cpus() > workers ? pool_cpus()/workers : 1;
+
+    //Leave room for workers started by hand as well as the forked ones
+    struct farm *farm = farm_create(path, width, height, workers + 16);
+    if(!farm){
+        fprintf(stderr, "fractalfarm: unable to listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    //Fork before any threads start in this process
+    for(int k = 0; k < workers; k++){
+        if(!farm_spawn(farm, threads)){
+            fprintf(stderr, "fractalfarm: unable to start a worker: %s\n", strerror(errno));
+            farm_delete(farm);
+            return 1;
+        }
+    }
+
+    printf("socket: %s\n", path);
+    printf("coordinates: %lf %lf %lf %lf\n", xmin, xmax, ymin, ymax);
+    printf("kernel: %s%s\n", mandel_kernel_name(), mandel_accelerated() ? " (accelerated)" : "");
+    printf("workers: %d with %d threads each\n", workers, threads);
+    fflush(stdout);
+
+    struct render_view view;
+    view.xmin = xmin;
+    view.xmax = xmax;
+    view.ymin = ymin;
+    view.ymax = ymax;
+    view.maxiter = maxiter;
+    view.orbit = 0;
+    view.formula = 0;
+
+    for(int k = 0; k < frames; k++){
+        double start = now();
+        if(!farm_render(farm, &view)){
+            fprintf(stderr, "fractalfarm: no workers left to render with: %s\n", strerror(errno));
+            farm_delete(farm);
+            return 1;
+        }
+        printf("Computed %d tiles with %d workers in %.4f seconds", farm->njobs, farm->nworkers, now() - start);
+        if(farm->reassigned) printf(", %d reassigned", farm->reassigned);
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if(output && !writeImage(output, farm, maxiter)){
+        fprintf(stderr, "fractalfarm: unable to write %s: %s\n", output, strerror(errno));
+    }
+
+    farm_delete(farm);
+    return 0;
+}
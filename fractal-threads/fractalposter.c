@@ -0,0 +1,255 @@
+/*
+fractalposter.c - Render a Mandelbrot poster far bigger than memory.
+The poster goes into a tiled pyramid on disk (pyramid.c) a square of
+tiles at a time, each square drawn by the tile renderer's threads, and
+then every coarser level is built from the one below it, again by all
+the threads.  Memory use stays the same whatever the poster's size.
+Run it again on the same file after an interruption and it carries on
+with just the tiles that are missing.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mandel.h"
+#include "pool.h"
+#include "render.h"
+#include "pyramid.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+//Poster tiles on a side of the square the renderer draws at once
+#define CHUNK_TILES 4
+#define CHUNK (CHUNK_TILES*PYRAMID_TILE)
+
+//A level of the pyramid being built, and how many threads share it
+struct level_job{
+    struct pyramid *poster;
+    int level;
+    int threads;
+    int failed;
+};
+
+//Current time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Return true if every tile of the square at (cx,cy) is already on disk
+int chunkDone(struct pyramid *poster, int cx, int cy){
+    const struct pyramid_level *l = &poster->header->level[0];
+
+    for(int ty = cy*CHUNK_TILES; ty < (cy+1)*CHUNK_TILES && ty < l->tiles_y; ty++){
+        for(int tx = cx*CHUNK_TILES; tx < (cx+1)*CHUNK_TILES && tx < l->tiles_x; tx++){
+            if(!pyramid_done(poster, 0, tx, ty)) return 0;
+        }
+    }
+    return 1;
+}
+
+//Copy the tiles of the square at (cx,cy) out of the renderer, which drew it from pixel (x0,y0), and finish each one
+int storeChunk(struct pyramid *poster, struct render *r, int cx, int cy, int x0, int y0){
+    const struct pyramid_level *l = &poster->header->level[0];
+
+    for(int ty = cy*CHUNK_TILES; ty < (cy+1)*CHUNK_TILES && ty < l->tiles_y; ty++){
+        for(int tx = cx*CHUNK_TILES; tx < (cx+1)*CHUNK_TILES && tx < l->tiles_x; tx++){
+            if(pyramid_done(poster, 0, tx, ty)) continue;
+
+            unsigned char *tile = pyramid_tile(poster, 0, tx, ty);
+            for(int j = 0; j < PYRAMID_TILE; j++){
+                int y = ty*PYRAMID_TILE + j;
+
+                for(int i = 0; i < PYRAMID_TILE; i++){
+                    int x = tx*PYRAMID_TILE + i;
+                    unsigned char *out = &tile[(j*PYRAMID_TILE + i)*3];
+
+                    //Past the edge of the poster the tile is just black
+                    unsigned int color = x < l->width && y < l->height ? r->pixels[(y - y0)*r->width + x - x0] : 0;
+                    out[0] = color >> 16;
+                    out[1] = color >> 8;
+                    out[2] = color;
+                }
+            }
+
+            if(!pyramid_finish(poster, 0, tx, ty)) return 0;
+        }
+    }
+    return 1;
+}
+
+//Thread body for building a level: thread id takes every threads'th tile that is not done yet
+void buildLevel(int id, void *arg){
+    struct level_job *job = arg;
+    const struct pyramid_level *l = &job->poster->header->level[job->level];
+    int count = l->tiles_x*l->tiles_y;
+
+    for(int t = id; t < count; t += job->threads){
+        int tx = t % l->tiles_x;
+        int ty = t / l->tiles_x;
+        if(pyramid_done(job->poster, job->level, tx, ty)) continue;
+
+        pyramid_downsample(job->poster, job->level, tx, ty);
+        if(!pyramid_finish(job->poster, job->level, tx, ty)) job->failed = 1;
+    }
+}
+
+//Print how to run it
+void usage(){
+    fprintf(stderr, "use: fractalposter [-a] [-g] [-s] [-t] [-A samples] [-j threads] [-w width] [-h height] [-m maxiter]\n");
+    fprintf(stderr, "                   [-view xmin xmax ymin ymax] [-export level file.ppm] poster\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    double view[4] = { -1.5, 0.5, -1.0, 1.0 };
+    int width = 16384;
+    int height = 16384;
+    int maxiter = 500;
+    int threads = 0;
+    int subdivide = 0;
+    int tiered = 0;
+    int scheme = PALETTE_GRAY;
+    int antialias = 0;
+    int exportLevel = -1;
+    const char *exportName = 0;
+    const char *path = 0;
+
+    mandel_init();
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+        else if(!strcmp(argv[i], "-s")) subdivide = 1;
+        else if(!strcmp(argv[i], "-t")) tiered = 1;
+        else if(!strcmp(argv[i], "-g")) scheme = PALETTE_GRADIENT;
+        else if(!strcmp(argv[i], "-A") && i+1 < argc) antialias = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-w") && i+1 < argc) width = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-h") && i+1 < argc) height = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-m") && i+1 < argc) maxiter = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-view") && i+4 < argc) for(int k = 0; k < 4; k++) view[k] = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-export") && i+2 < argc){
+            exportLevel = atoi(argv[++i]);
+            exportName = argv[++i];
+        }
+        else if(!path && argv[i][0] != '-') path = argv[i];
+        else usage();
+    }
+    if(!path || width < 1 || height < 1 || maxiter < 1 || view[1] <= view[0] || view[3] <= view[2]) usage();
+    if(antialias && (antialias < 2 || antialias > RENDER_AA_MAX)) usage();
+    if(threads < 1) threads = pool_cpus();
+
+    //Check the level to export before drawing anything
+    int levels = pyramid_levels(width, height);
+    if(exportName && (exportLevel < 0 || exportLevel >= levels)){
+        fprintf(stderr, "fractalposter: a %dx%d poster only has levels 0 to %d\n", width, height, levels-1);
+        return 1;
+    }
+
+    //Everything that changes the pixels, so a poster is only ever continued with the same settings
+    int mode = subdivide | tiered<<1 | mandel_accelerated()<<2 | scheme<<3 | antialias<<4;
+
+    struct pyramid *poster = pyramid_open(path, width, height, view, maxiter, mode);
+    if(!poster){
+        if(errno == EINVAL) fprintf(stderr, "fractalposter: %s holds a different poster\n", path);
+        else fprintf(stderr, "fractalposter: unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    const struct pyramid_header *h = poster->header;
+
+    //Each square is drawn with a pixel of its neighbors all round, so antialiasing sees the same edges as in one big frame
+    struct render *renderer = render_create(CHUNK+2, CHUNK+2, threads);
+    if(!renderer){
+        fprintf(stderr, "fractalposter: unable to allocate renderer: %s\n", strerror(errno));
+        return 1;
+    }
+    renderer->subdivide = subdivide;
+    renderer->tiered = tiered;
+    renderer->scheme = scheme;
+    renderer->antialias = antialias;
+
+    struct render_view rv;
+    rv.xmin = view[0];
+    rv.xmax = view[1];
+    rv.ymin = view[2];
+    rv.ymax = view[3];
+    rv.maxiter = maxiter;
+    rv.orbit = 0;
+    rv.formula = 0;
+
+    int chunksX = (h->level[0].tiles_x + CHUNK_TILES-1)/CHUNK_TILES;
+    int chunksY = (h->level[0].tiles_y + CHUNK_TILES-1)/CHUNK_TILES;
+    int total = chunksX*chunksY;
+
+    fprintf(stderr, "kernel: %s%s\n", mandel_kernel_name(), mandel_accelerated() ? " (accelerated)" : "");
+    fprintf(stderr, "poster: %dx%d in %d levels, %.0f MB on disk, with %d threads\n",
+        width, height, h->levels, poster->size/1e6, threads);
+
+    double start = now();
+    int drawn = 0;
+    int skipped = 0;
+
+    for(int cy = 0; cy < chunksY; cy++){
+        for(int cx = 0; cx < chunksX; cx++){
+            //Squares finished before an interruption are kept
+            if(chunkDone(poster, cx, cy)){
+                skipped++;
+                continue;
+            }
+
+            //A pixel more all round for antialiasing, but nothing past the edges of the poster
+            int x0 = cx*CHUNK > 0 ? cx*CHUNK-1 : 0;
+            int y0 = cy*CHUNK > 0 ? cy*CHUNK-1 : 0;
+            int x1 = (cx+1)*CHUNK+1 < width ? (cx+1)*CHUNK+1 : width;
+            int y1 = (cy+1)*CHUNK+1 < height ? (cy+1)*CHUNK+1 : height;
+
+            render_region(renderer, &rv, width, height, x0, y0, x1-x0, y1-y0, threads);
+            if(renderer->cancelled){
+                fprintf(stderr, "fractalposter: unable to allocate palette: %s\n", strerror(errno));
+                return 1;
+            }
+            if(!storeChunk(poster, renderer, cx, cy, x0, y0)){
+                fprintf(stderr, "fractalposter: unable to write %s: %s\n", path, strerror(errno));
+                return 1;
+            }
+
+            drawn++;
+            double elapsed = now() - start;
+            fprintf(stderr, "\rsquare %d of %d, %.1f Mpixels/s ", drawn+skipped, total, drawn*(double)CHUNK*CHUNK/elapsed/1e6);
+        }
+    }
+    fprintf(stderr, "\nDrew %d squares in %.4f seconds, %d already done\n", drawn, now() - start, skipped);
+
+    //Each level halves the one below, with the threads sharing out its tiles
+    double begin = now();
+    for(int level = 1; level < h->levels; level++){
+        struct level_job job;
+        job.poster = poster;
+        job.level = level;
+        job.threads = threads;
+        job.failed = 0;
+        pool_run(renderer->pool, threads, buildLevel, &job);
+
+        if(job.failed){
+            fprintf(stderr, "fractalposter: unable to write %s: %s\n", path, strerror(errno));
+            return 1;
+        }
+    }
+    fprintf(stderr, "Built levels 1 to %d in %.4f seconds\n", h->levels-1, now() - begin);
+
+    if(exportName){
+        FILE *file = fopen(exportName, "wb");
+        if(!file || !pyramid_write_ppm(poster, exportLevel, file) || fclose(file)){
+            fprintf(stderr, "fractalposter: unable to write %s: %s\n", exportName, strerror(errno));
+            return 1;
+        }
+    }
+
+    render_delete(renderer);
+    pyramid_close(poster);
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+fractalserver.c - A tile server for Mandelbrot, Julia and Multibrot maps.
+The daemon keeps one warm renderer and a cache of finished tiles, and
+serves tiles to every viewer and batch job that connects to its Unix
+domain socket.  The same program fetches a tile from a running daemon,
+as a raw PPM image or a PNG.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mandel.h"
+#include "pool.h"
+#include "server.h"
+#include "sock.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+//Where the daemon listens unless -s says otherwise, so clients can find it
+#define DEFAULT_SOCKET "/tmp/fractalserver"
+
+//Set by SIGINT or SIGTERM to shut the daemon down cleanly
+volatile sig_atomic_t stop = 0;
+
+void onSignal(int sig){
+    (void)sig;
+    stop = 1;
+}
+
+//Current time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Print how to run the daemon or fetch a tile from it
+void usage(){
+    fprintf(stderr, "use: fractalserver [-a] [-j threads] [-k megabytes] [-K dir] [-s socket]\n");
+    fprintf(stderr, "     fractalserver -fetch [-s socket] [-png] [-g] [-m maxiter] [-view xmin xmax ymin ymax]\n");
+    fprintf(stderr, "                   [-julia kr ki] [-power n] level tx ty file\n");
+    exit(1);
+}
+
+//Write a fetched tile out, with a PPM header if it came raw
+int writeTile(const char *name, const struct server_request *q, const unsigned char *data, size_t size){
+    FILE *file = fopen(name, "wb");
+    if(!file) return 0;
+
+    if(q->format == SERVER_RAW) fprintf(file, "P6\n%d %d\n255\n", SERVER_TILE, SERVER_TILE);
+    fwrite(data, 1, size, file);
+
+    return fclose(file) == 0;
+}
+
+//Fetch one tile from the daemon and write it to a file
+int fetch(const char *path, const struct server_request *q, const char *name){
+    int fd = sock_connect(path);
+    if(fd < 0){
+        fprintf(stderr, "fractalserver: unable to connect to %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    unsigned char *data;
+    size_t size;
+    double start = now();
+
+    if(!server_fetch(fd, q, &data, &size)){
+        fprintf(stderr, "fractalserver: unable to fetch tile %d/%d/%d: %s\n", q->level, q->tx, q->ty, strerror(errno));
+        return 1;
+    }
+    printf("Fetched tile %d/%d/%d, %zu bytes, in %.4f seconds\n", q->level, q->tx, q->ty, size, now() - start);
+
+    if(!writeTile(name, q, data, size)){
+        fprintf(stderr, "fractalserver: unable to write %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    free(data);
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    const char *path = DEFAULT_SOCKET;
+    const char *cacheDir = 0;
+    int megabytes = CACHE_DEFAULT_BYTES/(1024*1024);
+    int threads = 0;
+    int fetching = 0;
+    const char *args[4];
+    int nargs = 0;
+
+    //A request for the tile of the whole starting view, which the fetch flags change
+    struct server_request q;
+    memset(&q, 0, sizeof(q));
+    q.view[0] = -1.5;
+    q.view[1] = 0.5;
+    q.view[2] = -1.0;
+    q.view[3] = 1.0;
+    q.maxiter = 500;
+    q.scheme = PALETTE_GRAY;
+    q.format = SERVER_RAW;
+    q.formula.family = MANDEL_MULTIBROT;
+
+    mandel_init();
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-k") && i+1 < argc) megabytes = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-K") && i+1 < argc) cacheDir = argv[++i];
+        else if(!strcmp(argv[i], "-s") && i+1 < argc) path = argv[++i];
+        else if(!strcmp(argv[i], "-fetch")) fetching = 1;
+        else if(!strcmp(argv[i], "-png")) q.format = SERVER_PNG;
+        else if(!strcmp(argv[i], "-g")) q.scheme = PALETTE_GRADIENT;
+        else if(!strcmp(argv[i], "-m") && i+1 < argc) q.maxiter = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-view") && i+4 < argc) for(int k = 0; k < 4; k++) q.view[k] = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-julia") && i+2 < argc){
+            q.formula.family = MANDEL_JULIA;
+            q.formula.kr = atof(argv[++i]);
+            q.formula.ki = atof(argv[++i]);
+            if(!q.formula.power) q.formula.power = 2;
+        }
+        else if(!strcmp(argv[i], "-power") && i+1 < argc) q.formula.power = atoi(argv[++i]);
+        else if(argv[i][0] != '-' && nargs < 4) args[nargs++] = argv[i];
+        else usage();
+    }
+
+    if(fetching){
+        if(nargs != 4) usage();
+        q.level = atoi(args[0]);
+        q.tx = atoi(args[1]);
+        q.ty = atoi(args[2]);
+
+        //Power 2 without -julia is the Mandelbrot set itself
+        if(q.formula.family == MANDEL_MULTIBROT && q.formula.power == 2) q.formula.power = 0;
+        return fetch(path, &q, args[3]);
+    }
+
+    if(nargs || megabytes < 1 || (cacheDir && !*cacheDir)) usage();
+    if(threads < 1) threads = pool_cpus();
+
+    //The renderer's threads start with these signals blocked, so they always land on this thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    struct server *server = server_create(path, threads, (size_t)megabytes*1024*1024, cacheDir);
+    if(!server){
+        fprintf(stderr, "fractalserver: unable to listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    //No SA_RESTART, so the signal also wakes the daemon out of poll
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+    pthread_sigmask(SIG_UNBLOCK, &signals, 0);
+
+    printf("socket: %s\n", path);
+    printf("kernel: %s%s\n", mandel_kernel_name(), mandel_accelerated() ? " (accelerated)" : "");
+    printf("threads: %d, cache: %d MB%s%s\n", threads, megabytes, cacheDir ? " spilling to " : "", cacheDir ? cacheDir : "");
+    fflush(stdout);
+
+    if(!server_run(server, &stop)){
+        fprintf(stderr, "fractalserver: unable to wait for clients: %s\n", strerror(errno));
+    }
+
+    printf("Served %ld tiles: %ld drawn, %ld from the cache, %ld requests shared with another\n",
+        server->served, server->rendered, server->cached, server->shared);
+
+    //Writes the cache out to -K's directory for the next run
+    server_delete(server);
+    return 0;
+}
@@ -3,148 +3,236 @@ fractal.c - Sample Mandelbrot Fractal Display
 Starting code for CSE 30341 Project 3.
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "gfx.h"
+#include "mandel.h"
+#include "render.h"
+#include "deep.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
-#include <complex.h>
-#include <pthread.h>
+#include <time.h>
+
+//Tile renderer the threads draw with, sized to the window
+struct render *renderer = 0;
+
+//Number of threads the renderer starts, one per core unless -j says otherwise
+int maxThreads = 0;
+
+//Set by -c to pin each thread to its own core
+int pin = 0;
+
+//Set by -g to color with a smooth gradient instead of gray
+int scheme = PALETTE_GRAY;
+
+//Set by -A to antialias the edges with this many samples per side of a pixel
+int antialias = 0;
+
+//Set by -s to render with Mariani-Silver subdivision
+int subdivide = 0;
+
+//Set by -p to draw new views coarse to fine, giving up as soon as a key is pressed
+int progressive = 0;
+
+//Set by -t to pick float, double or double-double kernels from the zoom level
+int tiered = 0;
+
+//Set by -T to record every task each thread runs, and the file to save it in on exit
+struct trace *trace = 0;
+const char *traceFile = 0;
 
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t lock2 = PTHREAD_MUTEX_INITIALIZER;
+//Set by -k to keep finished tiles for views seen before, and by -K to keep them in a directory across runs
+struct cache *cache = 0;
+int caching = 0;
+const char *cacheDir = 0;
+
+//Set by -julia and -power to draw a Julia or Multibrot set instead of the Mandelbrot set
+struct mandel_formula formula = { MANDEL_MULTIBROT, 2, 0, 0 };
+int useFormula = 0;
+
+//Set by -d for deep zooms, where xmin..ymax are offsets from the reference point
+int deep = 0;
+struct deep_reference reference;
+
+//Make sure the renderer matches the window size
+void resizeRenderer(int width, int height){
+    if(renderer && width == renderer->width && height == renderer->height) return;
+
+    render_delete(renderer);
+    renderer = render_create(width, height, maxThreads);
+    if(!renderer){
+        fprintf(stderr, "fractaltask: unable to allocate renderer: %s\n", strerror(errno));
+        exit(1);
+    }
+    if(pin && !pool_pin(renderer->pool)){
+        fprintf(stderr, "fractaltask: unable to pin threads: %s\n", strerror(errno));
+    }
+    renderer->subdivide = subdivide;
+    renderer->tiered = tiered;
+    renderer->scheme = scheme;
+    renderer->antialias = antialias;
+    renderer->trace = trace;
+    renderer->cache = cache;
+}
+
+//Current time in seconds, used to measure how long a frame takes
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Fill in a view from the coordinates main keeps track of
+struct render_view makeView(double xmin, double xmax, double ymin, double ymax, double maxiter){
+    struct render_view view;
+    view.xmin = xmin;
+    view.xmax = xmax;
+    view.ymin = ymin;
+    view.ymax = ymax;
+    view.maxiter = maxiter;
+    view.orbit = deep ? &reference.orbit : 0;
+    view.formula = useFormula ? &formula : 0;
+    return view;
+}
 
-int *tasks = 0;
 /*
-Compute the number of iterations at point x, y
-in the complex space, up to a maximum of maxiter.
-Return the number of iterations at that point.
-
-This example computes the Mandelbrot fractal:
-z = z^2 + alpha
-
-Where z is initially zero, and alpha is the location x + iy
-in the complex plane.  Note that we are using the "complex"
-numeric type in C, which has the special functions cabs()
-and cpow() to compute the absolute values and powers of
-complex values.
+Keep the deep zoom reference good enough for the view around it.
+It moves to the center of the view once the view has wandered a
+screen away, and the orbit is redone with more bits as the pixels
+get smaller, or with more iterations as maxiter goes up.
 */
-void *compute_image(void *);
 
-//Thread argument struct
-struct thread_args{
-    double xmin;
-    double xmax;
-    double ymin;
-    double ymax;
-    double maxiter;
-};
+void updateReference(double *xmin, double *xmax, double *ymin, double *ymax, int maxiter){
+    double cx = (*xmin + *xmax)/2;
+    double cy = (*ymin + *ymax)/2;
+    mp_bitcnt_t bits = deep_bits((*xmax - *xmin)/gfx_xsize());
 
+    int moved = fabs(cx) > *xmax - *xmin || fabs(cy) > *ymax - *ymin;
+    if(!moved && reference.bits >= bits && reference.maxiter >= maxiter) return;
 
-void createThreads(int numT, double xmin, double xmax, double ymin, double ymax, double maxiter){
-     
-    //Create the tasks array and assign every "pixel" a value
-    tasks = malloc(sizeof(int)*gfx_ysize());
-    for(int j = 0; j < gfx_ysize(); j++)
-        tasks[j] = 0;
-
-
-    //Thread array and counter
-    pthread_t threads[numT];
-
-    struct thread_args *args;
-    //Create the threads and loop through number of threads we have
-    for(int i = 0; i < numT; i++){
-        //Create a thread argument struct to pass to the compute-image
-        args = malloc(sizeof(struct thread_args));
-        args->ymin = ymin;
-        args->ymax = ymax;
-        args->xmin = xmin;
-        args->xmax = xmax;
-        args->maxiter = maxiter;
-
-        //Create the threads and run the function
-        pthread_create(&threads[i], NULL, compute_image, args);    
+    if(moved){
+        deep_move(&reference, cx, cy, bits);
+        *xmin -= cx;
+        *xmax -= cx;
+        *ymin -= cy;
+        *ymax -= cy;
     }
 
-    //Join the threads
-    for(int i = 0; i < numT; i++)
-        pthread_join(threads[i], NULL);
+    if(!deep_compute(&reference, maxiter, bits)){
+        fprintf(stderr, "fractaltask: unable to allocate reference orbit: %s\n", strerror(errno));
+        exit(1);
+    }
+    if(moved) deep_print(&reference);
 
-    return;
+    //The old frame was drawn from a different orbit
+    resizeRenderer(gfx_xsize(), gfx_ysize());
+    render_invalidate(renderer);
 }
 
+/*
+Compute an entire image with numT threads and show it.
+The renderer splits the image into tiles and the threads steal
+tiles from each other until every one of them is done.
+Scale the image to the range (xmin-xmax,ymin-ymax).
+*/
 
-static int compute_point( double x, double y, int max )
-{
-	double complex z = 0;
-	double complex alpha = x + I*y;
+void createThreads(int numT, double xmin, double xmax, double ymin, double ymax, double maxiter){
 
-	int iter = 0;
+    //Make room for every pixel the threads are about to draw
+    resizeRenderer(gfx_xsize(), gfx_ysize());
 
-	while( cabs(z)<4 && iter < max ) {
-		z = cpow(z,2) + alpha;
-		iter++;
-	}
+    struct render_view view = makeView(xmin, xmax, ymin, ymax, maxiter);
 
-	return iter;
+    //Run the threads until every tile is computed
+    render_image(renderer, &view, numT);
+
+    //Send the finished frame to the window in one piece
+    gfx_put_image(renderer->pixels, renderer->width, renderer->height);
+
+    return;
+}
+
+//Show a coarse pass of a progressive frame right away
+void showPass(struct render *r){
+    gfx_put_image(r->pixels, r->width, r->height);
+    gfx_flush();
 }
 
 /*
-Compute an entire image, writing each point to the given bitmap.
-Scale the image to the range (xmin-xmax,ymin-ymax).
+Like createThreads, but when the view has only been panned by whole
+pixels, keep the last frame, shift it over, and only compute the strip
+that came into view. The frame is given up on as soon as a key is
+pressed, since the view it shows is already out of date. Returns the
+number of pixels computed, or -1 if the frame was given up on.
 */
 
-void *compute_image(void *myArgs)
-{
-	int i,j;
-    int width = gfx_xsize();
-    int height = gfx_ysize();
-
-	//Take in the argument struct and assign appropriately
-    struct thread_args *args = (struct thread_args*)myArgs;
-    double xmin = args->xmin;
-    double xmax = args->xmax;
-    double ymin = args->ymin;
-    double ymax = args->ymax;
-    double maxiter = args->maxiter;
-
-    // For every pixel i,j, in the image...
-    for(int j = 0; j < height; j++){
-        int status = 0;
-
-        //Critical section
-        pthread_mutex_lock(&lock2);
-        //Check if the current line has been drawn
-        if(tasks[j] == 0)
-            status = 1;
-        pthread_mutex_unlock(&lock2);
-
-        //If the current line has not been drawn, draw it!
-        if(status == 1){
-            for(i=0;i<width;i++) {
-                tasks[j] = 1;
-                
-			    double x = xmin + i*(xmax-xmin)/width;
-			    double y = ymin + j*(ymax-ymin)/height;
-
-                pthread_mutex_lock(&lock);
-			    // Compute the iterations at x,y
-			    int iter = compute_point(x,y,maxiter);
-
-			    // Convert a iteration number to an RGB color.
-			    // (Change this bit to get more interesting colors.)
-			    int gray = 255 * iter / maxiter;
-                gfx_color(gray,gray,gray);
-			    gfx_point(i,j);
-                pthread_mutex_unlock(&lock);
-            }
-        }
-   
+int updateImage(int numT, double xmin, double xmax, double ymin, double ymax, double maxiter){
+
+    resizeRenderer(gfx_xsize(), gfx_ysize());
+
+    struct render_view view = makeView(xmin, xmax, ymin, ymax, maxiter);
+    int computed;
+
+    //Without -p the frame comes in one pass, but is still dropped for a key
+    computed = render_progressive(renderer, &view, numT, progressive ? showPass : 0, gfx_event_waiting);
+    //Leave the last pass or frame up and go handle the key
+    if(computed < 0) return computed;
+
+    gfx_put_image(renderer->pixels, renderer->width, renderer->height);
+
+    return computed;
 }
- 
-    return NULL;
+
+//Round a distance to a whole number of pixels, so a pan can reuse the last frame
+double snapToPixels(double dist, double span, int pixels){
+    double steps = round(dist*pixels/span);
+    if(steps < 1) steps = 1;
+    return steps*span/pixels;
+}
+
+
+//Write the trace out, if there is one
+void saveTrace(){
+    if(trace && !trace_save(trace, traceFile)){
+        fprintf(stderr, "fractaltask: unable to write %s: %s\n", traceFile, strerror(errno));
+    }
+}
+
+//Thread counts for the speedup curve: every count up to 8, then doubling, and always every thread at the end
+int nextCount(int n){
+    int next = n < 8 ? n+1 : n*2;
+    return n < maxThreads && next > maxThreads ? maxThreads : next;
+}
+
+//Render the current view with 1 thread up to every thread, report the speedup over 1 thread, and where it stops growing
+void speedupCurve(double xmin, double xmax, double ymin, double ymax, double maxiter){
+    double base = 0;
+    double last = 0;
+    int flat = 0;
+
+    //Every run after the first would come straight out of the cache
+    renderer->cache = 0;
+
+    printf("threads\tseconds\tspeedup\tefficiency\n");
+    for(int n = 1; n <= maxThreads; n = nextCount(n)){
+        double start = now();
+        createThreads(n, xmin, xmax, ymin, ymax, maxiter);
+        double elapsed = now() - start;
+
+        if(n == 1) base = elapsed;
+        double speedup = base/elapsed;
+        printf("%d\t%.4f\t%.2fx\t%.0f%%\n", n, elapsed, speedup, 100*speedup/n);
+
+        //Scaling has flattened out once more threads buy less than a tenth more speed
+        if(!flat && n > 1 && speedup < last*1.1) flat = n;
+        last = speedup;
+    }
+    if(flat) printf("scaling flattens out at %d threads\n", flat);
+
+    renderer->cache = cache;
 }
 
 
@@ -161,7 +249,98 @@ int main( int argc, char *argv[] )
 	// Maximum number of iterations to compute.
 	// Higher values take longer but have more detail.
 	int maxiter=500;
-    int threadCount = 1;
+
+	// Pick the fastest kernel for this machine.
+	mandel_init();
+
+	// Use every core this process may run on.
+	maxThreads = pool_cpus();
+
+	// -a skips the inside of the set: cardioid and bulb checks plus cycle detection.
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+		// -s fills tiles whose border is all one count instead of computing them
+		else if(!strcmp(argv[i], "-s")) subdivide = 1;
+		// -p shows a rough frame first and drops it if another key comes in
+		else if(!strcmp(argv[i], "-p")) progressive = 1;
+		// -d zooms past the limits of double precision
+		else if(!strcmp(argv[i], "-d")) deep = 1;
+		// -t uses floats when zoomed out and double-doubles when zoomed in
+		else if(!strcmp(argv[i], "-t")) tiered = 1;
+		// -j sets how many threads to start, and -c pins each of them to its own core
+		else if(!strcmp(argv[i], "-j") && i+1 < argc) maxThreads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-c")) pin = 1;
+		// -g colors with a smooth gradient instead of gray
+		else if(!strcmp(argv[i], "-g")) scheme = PALETTE_GRADIENT;
+		// -A takes 2x2 up to 4x4 samples of the pixels where the count jumps
+		else if(!strcmp(argv[i], "-A") && i+1 < argc) antialias = atoi(argv[++i]);
+		// -T records what every thread did in each frame, saved to the file on exit
+		else if(!strcmp(argv[i], "-T") && i+1 < argc) traceFile = argv[++i];
+		// -k keeps tiles to show views seen before at once, and -K also keeps them in a directory for next time
+		else if(!strcmp(argv[i], "-k")) caching = 1;
+		else if(!strcmp(argv[i], "-K") && i+1 < argc) { caching = 1; cacheDir = argv[++i]; }
+		// -julia draws the Julia set of the constant kr+i*ki, and -power raises z to another power than 2
+		else if(!strcmp(argv[i], "-julia") && i+2 < argc) {
+			formula.family = MANDEL_JULIA;
+			formula.kr = atof(argv[++i]);
+			formula.ki = atof(argv[++i]);
+			useFormula = 1;
+		}
+		else if(!strcmp(argv[i], "-power") && i+1 < argc) {
+			formula.power = atoi(argv[++i]);
+			useFormula = 1;
+		}
+	}
+	if(maxThreads < 1) maxThreads = 1;
+	if(antialias && (antialias < 2 || antialias > RENDER_AA_MAX)) {
+		fprintf(stderr, "fractaltask: -A takes 2 to %d samples per side\n", RENDER_AA_MAX);
+		exit(1);
+	}
+
+	if(useFormula && (formula.power < 2 || formula.power > MANDEL_MAX_POWER)) {
+		fprintf(stderr, "fractaltask: -power takes 2 to %d\n", MANDEL_MAX_POWER);
+		exit(1);
+	}
+	if(useFormula && deep) {
+		fprintf(stderr, "fractaltask: -d only zooms into the Mandelbrot set\n");
+		exit(1);
+	}
+
+	// Julia and Multibrot sets sit around the origin.
+	if(useFormula) {
+		xmin = -2.0;
+		xmax = 2.0;
+		ymin = -1.5;
+		ymax = 1.5;
+	}
+
+	if(traceFile) {
+		trace = trace_create(maxThreads);
+		if(!trace) {
+			fprintf(stderr, "fractaltask: unable to allocate trace: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+    int threadCount = maxThreads;
+
+	if(caching) {
+		cache = cache_create(CACHE_DEFAULT_BYTES, cacheDir);
+		if(!cache) {
+			fprintf(stderr, "fractaltask: unable to allocate cache: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+
+	// In deep mode the view is kept relative to a reference point, starting at its center.
+	if(deep) {
+		double cx = (xmin+xmax)/2;
+		double cy = (ymin+ymax)/2;
+		deep_init(&reference, cx, cy);
+		xmin -= cx;
+		xmax -= cx;
+		ymin -= cy;
+		ymax -= cy;
+	}
 
 	// Open a new window.
 	gfx_open(640,480,"Mandelbrot Fractal");
@@ -169,6 +348,10 @@ int main( int argc, char *argv[] )
 
 	// Show the configuration, just in case you want to recreate it.
 	printf("coordinates: %lf %lf %lf %lf\n",xmin,xmax,ymin,ymax);
+	printf("kernel: %s%s\n",mandel_kernel_name(),mandel_accelerated() ? " (accelerated)" : "");
+	printf("threads: %d%s\n",maxThreads,pin ? " (pinned)" : "");
+	if(formula.family == MANDEL_JULIA) printf("formula: z^%d + %lf%+lfi\n",formula.power,formula.kr,formula.ki);
+	else if(useFormula) printf("formula: z^%d + c\n",formula.power);
 
 	// Fill it with a dark blue initially.
 	gfx_clear_color(0,0,255);
@@ -178,71 +361,115 @@ int main( int argc, char *argv[] )
 	// Display the fractal image
     double vert = 0.1;
     double hor = 0.1;
+    int lastTier = -1;
 
 	while(1) {
-		// Wait for a key or mouse click.
+		// Wait for a key or mouse click, now that the latest view is on screen.
         int c = gfx_wait();
-        gfx_clear();
+        int keys = 0;
+        int redraw = 0;
+
+        //Take every key that came in meanwhile before drawing, so a burst of them costs one frame
+        do{
+            if(keys++) c = gfx_wait();
+            double step;
+
+            //Deep and tiered zooms go in and out by a fraction of the view instead of a fixed amount,
+            //so they can get deep enough for double-doubles and beyond
+            if(deep || tiered){
+                hor = (xmax-xmin)/10;
+                vert = (ymax-ymin)/10;
+            }
  
-        //Determine the thread count
-        if(c == '1') threadCount = 1;
-        else if(c == '2') threadCount = 2;
-        else if(c == '3') threadCount = 3;
-        else if(c == '4') threadCount = 4;
-        else if(c == '5') threadCount = 5;
-        else if(c == '6') threadCount = 6;
-        else if(c == '7') threadCount = 7;
-        else if(c == '8') threadCount = 8;
-
-        //Determine movement information
-        switch(c){
-            case '=':       //Zoom in
-                xmin+=hor;
-                xmax-=hor;
-                ymin+=vert;
-                ymax-=vert;
-                break;
-            case '-':       //Zoom out
-                xmin-=hor;
-                xmax+=hor;
-                ymin-=vert;
-                ymax+=vert;
-                break;
-            case 'w':       //Move up
-                ymin+=vert;
-                ymax+=vert;
-                break;
-            case 'a':       //Move left
-                xmin+=hor;
-                xmax+=hor;
-                break;
-            case 's':       //Move down
-                ymin-=vert;
-                ymax-=vert;
-                break;
-            case 'd':       //Move right
-                xmin-=hor;
-                xmax-=hor;
-                break;
-            case 'z':       //Decrease iter
-                if((maxiter-50) < 0) break;
-                maxiter-=50;
-                break;
-            case 'x':       //Increase iter
-                maxiter+=50;
-                break;
-            case 'q':       //Quit
-                exit(0);
-                break;
-            default:
-                break;
+            //Determine the thread count
+            if(c >= '1' && c <= '9') threadCount = c - '0' < maxThreads ? c - '0' : maxThreads;
+            else if(c == '0') threadCount = maxThreads;
+
+            //Determine movement information
+            switch(c){
+                case '=':       //Zoom in
+                    xmin+=hor;
+                    xmax-=hor;
+                    ymin+=vert;
+                    ymax-=vert;
+                    break;
+                case '-':       //Zoom out
+                    xmin-=hor;
+                    xmax+=hor;
+                    ymin-=vert;
+                    ymax+=vert;
+                    break;
+                case 'w':       //Move up
+                    step = snapToPixels(vert, ymax-ymin, gfx_ysize());
+                    ymin+=step;
+                    ymax+=step;
+                    break;
+                case 'a':       //Move left
+                    step = snapToPixels(hor, xmax-xmin, gfx_xsize());
+                    xmin+=step;
+                    xmax+=step;
+                    break;
+                case 's':       //Move down
+                    step = snapToPixels(vert, ymax-ymin, gfx_ysize());
+                    ymin-=step;
+                    ymax-=step;
+                    break;
+                case 'd':       //Move right
+                    step = snapToPixels(hor, xmax-xmin, gfx_xsize());
+                    xmin-=step;
+                    xmax-=step;
+                    break;
+                case 'z':       //Decrease iter
+                    if((maxiter-50) < 0) break;
+                    maxiter-=50;
+                    break;
+                case 'x':       //Increase iter
+                    maxiter+=50;
+                    break;
+                case 1:         //Click to center the view there
+                    step = round(gfx_xpos() - gfx_xsize()/2.0)*(xmax-xmin)/gfx_xsize();
+                    xmin+=step;
+                    xmax+=step;
+                    step = round(gfx_ypos() - gfx_ysize()/2.0)*(ymax-ymin)/gfx_ysize();
+                    ymin+=step;
+                    ymax+=step;
+                    break;
+                case 'b':       //Speedup curve
+                    speedupCurve(xmin, xmax, ymin, ymax, maxiter);
+                    continue;
+                case 'q':       //Quit
+                    saveTrace();
+                    //Write out the tiles still in memory for next time
+                    cache_delete(cache);
+                    exit(0);
+                    break;
+                default:
+                    break;
 
+            }
+            redraw = 1;
+        }while(gfx_event_waiting());
+
+        if(!redraw) continue;
+
+        //Create the image, reusing the last one if this was a pan
+        double start = now();
+        if(deep) updateReference(&xmin, &xmax, &ymin, &ymax, maxiter);
+        int computed = updateImage(threadCount, xmin, xmax, ymin, ymax, maxiter);
+        if(computed < 0){
+            //The view has already moved on, so go and catch up with it
+            printf("Dropped a stale frame after %.4f seconds\n", now() - start);
+            continue;
         }
-
-        //Create the image
-        createThreads(threadCount, xmin, xmax, ymin, ymax, maxiter);
         //Let the people know we made it
-        printf("Computed\n");
+        printf("Computed %d pixels with %d threads in %.4f seconds", computed, threadCount, now() - start);
+        if(keys > 1) printf(" for %d keys", keys);
+        printf("\n");
+        //And say so whenever the zoom level calls for another precision
+        if(tiered && renderer->tier != lastTier){
+            printf("tier: %s\n", mandel_tier_name(renderer->tier));
+            lastTier = renderer->tier;
+        }
 	}
 
 	return 0;
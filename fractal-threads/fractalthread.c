@@ -3,32 +3,119 @@ fractal.c - Sample Mandelbrot Fractal Display
 Starting code for CSE 30341 Project 3.
 */
 
+#define _GNU_SOURCE
+
 #include "gfx.h"
+#include "mandel.h"
+#include "pool.h"
+#include "palette.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
 #include <string.h>
-#include <complex.h>
-#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//Threads that live for the whole program and wait for each frame
+struct pool *pool = 0;
+
+//Number of threads in the pool, one per core unless -j says otherwise
+int maxThreads = 0;
+
+//Framebuffer the threads draw into before it is sent to the window
+unsigned int *framebuffer = 0;
+int fbWidth = 0;
+int fbHeight = 0;
+
+//Colors for every iteration count, redone only when maxiter changes
+struct palette palette;
+
+//Set by -g to color with a gradient instead of gray
+int scheme = PALETTE_GRAY;
+
+//Set by -T to record every row each thread computes, and the file to save it in on exit
+struct trace *trace = 0;
+const char *traceFile = 0;
+
+//Iterations each row took in the last frame, used to split the next one evenly
+long *rowCost = 0;
+
+//Set by -c to pin each thread to its own core
+int pin = 0;
 
- pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+//The thread count the framebuffer's pages were last placed for, or 0 since it was mapped
+int placedThreads = 0;
+
+//Map a framebuffer that no thread has touched yet, so none of its pages are placed
+unsigned int *mapFramebuffer(int width, int height){
+    void *p = mmap(0, (size_t)width*height*sizeof(unsigned int), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+        fprintf(stderr, "fractalthread: unable to allocate framebuffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    return p;
+}
+
+//Make sure the framebuffer matches the window size
+void resizeFramebuffer(int width, int height){
+    if(width == fbWidth && height == fbHeight) return;
+
+    if(framebuffer) munmap(framebuffer, (size_t)fbWidth*fbHeight*sizeof(unsigned int));
+    free(rowCost);
+    framebuffer = mapFramebuffer(width, height);
+    rowCost = calloc(height, sizeof(long));
+    if(!rowCost){
+        fprintf(stderr, "fractalthread: unable to allocate framebuffer: %s\n", strerror(errno));
+        exit(1);
+    }
+    fbWidth = width;
+    fbHeight = height;
+    placedThreads = 0;
+}
+
+//Clear one thread's share of the framebuffer's pages, so they are placed on that thread's NUMA node
+void placeBand(int id, void *arg){
+    int numT = *(const int *)arg;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t bytes = (size_t)fbWidth*fbHeight*sizeof(unsigned int);
+    size_t pages = (bytes + page-1)/page;
+    size_t start = pages*id/numT*page;
+    size_t end = pages*(id+1)/numT*page;
+
+    if(end > bytes) end = bytes;
+    if(start < end) memset((char *)framebuffer + start, 0, end - start);
+}
 
 /*
-Compute the number of iterations at point x, y
-in the complex space, up to a maximum of maxiter.
-Return the number of iterations at that point.
-
-This example computes the Mandelbrot fractal:
-z = z^2 + alpha
-
-Where z is initially zero, and alpha is the location x + iy
-in the complex plane.  Note that we are using the "complex"
-numeric type in C, which has the special functions cabs()
-and cpow() to compute the absolute values and powers of
-complex values.
+Linux places a page on the node of the thread that touches it first, and
+leaves it there.  The bands each frame is drawn in follow the last
+frame's row costs and move on nearly every frame, too often to chase, so
+instead the pages are split evenly between the threads, on page
+boundaries, and placed once for each thread count: when the count
+changes, the frame goes into a fresh framebuffer that each thread first
+clears its share of.  This is done before a frame is timed, and only
+with -c, since threads that are not pinned move between nodes anyway.
 */
-void *compute_image(void *);
+
+void placeFramebuffer(int numT){
+    resizeFramebuffer(gfx_xsize(), gfx_ysize());
+
+    //createThreads never runs more threads than rows
+    if(numT > fbHeight) numT = fbHeight;
+    if(!pin || numT == placedThreads) return;
+
+    if(placedThreads){
+        munmap(framebuffer, (size_t)fbWidth*fbHeight*sizeof(unsigned int));
+        framebuffer = mapFramebuffer(fbWidth, fbHeight);
+    }
+    pool_run(pool, numT, placeBand, &numT);
+    placedThreads = numT;
+}
+
+void compute_image(int, void *);
 
 //Thread argument structure
 struct thread_args{
@@ -42,81 +129,148 @@ struct thread_args{
 };
 
 
+//Current time in seconds, used to measure how long a frame takes
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/*
+Split the rows into numT bands of about equal cost, where a row costs
+the iterations it took in the last frame plus one for each pixel.
+Every row goes to some band, and every band gets at least one row.
+The first frame has no costs yet, so its bands are just equal in size.
+*/
+
+void partitionRows(int numT, int height, int width, int *starts){
+    long total = 0;
+    for(int j = 0; j < height; j++) total += rowCost[j] + width;
+
+    long cost = 0;
+    int j = 0;
+    starts[0] = 0;
+    for(int k = 1; k < numT; k++){
+        //Stop once the bands so far carry k/numT of the cost, leaving a row for each band still to come
+        long target = total*k/numT;
+        while(j < height - (numT-k) && (j < starts[k-1]+1 || cost + (rowCost[j] + width)/2 < target)){
+            cost += rowCost[j] + width;
+            j++;
+        }
+        starts[k] = j;
+    }
+    starts[numT] = height;
+}
+
 void createThreads(int numT, double xmin, double xmax, double ymin, double ymax, double maxiter){
-    
-    //Chunk variables
-    int sH = 0;
-    int eH = 0;
-
-    //Step and pixel counter
-    int pixelCounter = 0;
-    int step = gfx_ysize()/numT;
-    int num = 0;
-
-    //Array of threads
-    pthread_t threads[numT];
-    int i = 0;
-
-    struct thread_args *args;
-    //Create the threads and divide the pixel count
-    for(int pixCount = 0; pixCount+step<=gfx_ysize(); pixCount += step){
-        sH = pixCount;
-        eH = pixCount + step;
 
-        //Creat the arguments for the current thread
-        args = malloc(sizeof(struct thread_args));
-        args->ymin = ymin;
-        args->ymax = ymax;
-        args->xmin = xmin;
-        args->xmax = xmax;
-        args->maxiter = maxiter;
-        args->sH = sH;
-        args->eH = eH;
-
-        //Create the threads and compute function
-        pthread_create(&threads[i], NULL, compute_image, args);
-        i++;
+    //Make room for every pixel the threads are about to draw
+    resizeFramebuffer(gfx_xsize(), gfx_ysize());
+
+    //Work out the colors once for this maxiter, before any thread needs them
+    if(!palette_update(&palette, scheme, maxiter)){
+        fprintf(stderr, "fractalthread: unable to allocate palette: %s\n", strerror(errno));
+        exit(1);
     }
 
-    //Join the threads
+    //More threads than rows would leave some with nothing to do
+    if(numT > fbHeight) numT = fbHeight;
+
+    //Divide the rows between the threads by what they cost last time
+    int starts[numT+1];
+    partitionRows(numT, fbHeight, fbWidth, starts);
+
+    //One set of arguments per thread, reused every frame
+    struct thread_args args[numT];
     for(int i = 0; i < numT; i++){
-        pthread_join(threads[i], NULL);
+        //Creat the arguments for the current thread
+        args[i].ymin = ymin;
+        args[i].ymax = ymax;
+        args[i].xmin = xmin;
+        args[i].xmax = xmax;
+        args[i].maxiter = maxiter;
+        args[i].sH = starts[i];
+        args[i].eH = starts[i+1];
+    }
+
+    long long start = 0;
+    if(trace){
+        trace_next_frame(trace);
+        start = trace_now(trace);
+    }
+
+    //Wake the threads up and wait for all of them to finish
+    pool_run(pool, numT, compute_image, args);
+
+    //The frame goes in thread 0's record, now that the others have stopped
+    if(trace){
+        struct trace_event e = {0};
+        e.kind = TRACE_FRAME;
+        e.start = start;
+        e.duration = trace_now(trace) - start;
+        e.w = fbWidth;
+        e.h = fbHeight;
+        trace_add(trace, 0, &e);
     }
-    
+
+    //Send the finished frame to the window in one piece
+    gfx_put_image(framebuffer, fbWidth, fbHeight);
 
     return;
 
 }
 
 
-static int compute_point( double x, double y, int max )
-{
-	double complex z = 0;
-	double complex alpha = x + I*y;
-
-	int iter = 0;
+//Write the trace out, if there is one
+void saveTrace(){
+    if(trace && !trace_save(trace, traceFile)){
+        fprintf(stderr, "fractalthread: unable to write %s: %s\n", traceFile, strerror(errno));
+    }
+}
 
-	while( cabs(z)<4 && iter < max ) {
-		z = cpow(z,2) + alpha;
-		iter++;
-	}
+//Thread counts for the speedup curve: every count up to 8, then doubling, and always every thread at the end
+int nextCount(int n){
+    int next = n < 8 ? n+1 : n*2;
+    return n < maxThreads && next > maxThreads ? maxThreads : next;
+}
 
-	return iter;
+//Render the current view with 1 thread up to every thread, report the speedup over 1 thread, and where it stops growing
+void speedupCurve(double xmin, double xmax, double ymin, double ymax, double maxiter){
+    double base = 0;
+    double last = 0;
+    int flat = 0;
+
+    printf("threads\tseconds\tspeedup\tefficiency\n");
+    for(int n = 1; n <= maxThreads; n = nextCount(n)){
+        placeFramebuffer(n);
+        double start = now();
+        createThreads(n, xmin, xmax, ymin, ymax, maxiter);
+        double elapsed = now() - start;
+
+        if(n == 1) base = elapsed;
+        double speedup = base/elapsed;
+        printf("%d\t%.4f\t%.2fx\t%.0f%%\n", n, elapsed, speedup, 100*speedup/n);
+
+        //Scaling has flattened out once more threads buy less than a tenth more speed
+        if(!flat && n > 1 && speedup < last*1.1) flat = n;
+        last = speedup;
+    }
+    if(flat) printf("scaling flattens out at %d threads\n", flat);
 }
 
 /*
-Compute an entire image, writing each point to the given bitmap.
+Compute an entire image, writing each point to the framebuffer.
 Scale the image to the range (xmin-xmax,ymin-ymax).
 */
 
-void *compute_image(void *myArgs)
+void compute_image(int id, void *myArgs)
 {
 	int i,j;
     int width = gfx_xsize();
     int height = gfx_ysize();
 
 	// For every pixel i,j, in the image...
-    struct thread_args *args = (struct thread_args*)myArgs;
+    struct thread_args *args = (struct thread_args*)myArgs + id;
     int sH = args->sH;
     int eH = args->eH;
     double xmin = args->xmin;
@@ -125,28 +279,44 @@ void *compute_image(void *myArgs)
     double ymax = args->ymax;
     double maxiter = args->maxiter;
 
+    int iters[width];
+
 	for(j=sH;j<eH;j++) {
+		long long start = trace ? trace_now(trace) : 0;
+
+		// Scale from row j to coordinate y
+		double y = ymin + j*(ymax-ymin)/height;
+
+		// Compute the iterations for every x,y in the row at once
+		mandel_row(xmin,xmax,width,0,width,y,maxiter,iters);
+
+		// Remember what the row cost, to split the next frame by.
+		long cost = 0;
+
 		for(i=0;i<width;i++) {
+			int iter = iters[i];
+			cost += iter;
+
+			// Look up the color of the iteration number.
+			framebuffer[j*width+i] = palette_color(&palette,iter);
+		}
 
-			// Scale from pixels i,j to coordinates x,y
-			double x = xmin + i*(xmax-xmin)/width;
-			double y = ymin + j*(ymax-ymin)/height;
-
-            //Critical section begins
-            pthread_mutex_lock(&lock);
-			// Compute the iterations at x,y
-			int iter = compute_point(x,y,maxiter);
-
-			// Convert a iteration number to an RGB color.
-			// (Change this bit to get more interesting colors.)
-			int gray = 255 * iter / maxiter;
-            gfx_color(gray,gray,gray);
-			gfx_point(i,j);
-            pthread_mutex_unlock(&lock);
+		rowCost[j] = cost;
+
+		// Each thread only adds to its own record, so this takes no lock.
+		if(trace) {
+			struct trace_event e = {0};
+			e.kind = TRACE_ROW;
+			e.start = start;
+			e.duration = trace_now(trace) - start;
+			e.y = j;
+			e.w = width;
+			e.h = 1;
+			e.iterations = cost;
+			e.pixels = width;
+			trace_add(trace, id, &e);
 		}
 	}
- 
-    return NULL;
 }
 
 int main( int argc, char *argv[] )
@@ -162,13 +332,54 @@ int main( int argc, char *argv[] )
 	// Maximum number of iterations to compute.
 	// Higher values take longer but have more detail.
 	int maxiter=500;
-    int threadCount = 1;
+
+	// Pick the fastest kernel for this machine.
+	mandel_init();
+
+	// Use every core this process may run on.
+	maxThreads = pool_cpus();
+
+	// -a skips the inside of the set: cardioid and bulb checks plus cycle detection.
+	// -j sets how many threads to start, and -c pins each of them to its own core.
+	// -g colors with a gradient instead of gray.
+	// -T records what every thread did in each frame, saved to the file on exit.
+	palette_init(&palette);
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+		else if(!strcmp(argv[i], "-g")) scheme = PALETTE_GRADIENT;
+		else if(!strcmp(argv[i], "-j") && i+1 < argc) maxThreads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-c")) pin = 1;
+		else if(!strcmp(argv[i], "-T") && i+1 < argc) traceFile = argv[++i];
+	}
+	if(maxThreads < 1) maxThreads = 1;
+
+	if(traceFile) {
+		trace = trace_create(maxThreads);
+		if(!trace) {
+			fprintf(stderr, "fractalthread: unable to allocate trace: %s\n", strerror(errno));
+			exit(1);
+		}
+	}
+    int threadCount = maxThreads;
+
+	// Start the threads once; every frame reuses them.
+	pool = pool_create(maxThreads);
+	if(!pool) {
+		fprintf(stderr, "fractalthread: unable to start threads: %s\n", strerror(errno));
+		exit(1);
+	}
+	if(pin && !pool_pin(pool)) {
+		fprintf(stderr, "fractalthread: unable to pin threads: %s\n", strerror(errno));
+		pin = 0;
+	}
 
 	// Open a new window.
 	gfx_open(640,480,"Mandelbrot Fractal");
 
 	// Show the configuration, just in case you want to recreate it.
 	printf("coordinates: %lf %lf %lf %lf\n",xmin,xmax,ymin,ymax);
+	printf("kernel: %s%s\n",mandel_kernel_name(),mandel_accelerated() ? " (accelerated)" : "");
+	printf("threads: %d%s\n",maxThreads,pin ? " (pinned)" : "");
 
 	// Fill it with a dark blue initially
 	gfx_clear_color(0,0,255);
@@ -181,17 +392,10 @@ int main( int argc, char *argv[] )
 	while(1) {
 		// Wait for a key or mouse click.
         int c = gfx_wait();
-        gfx_clear();
  
         //Determine the thread count
-        if(c == '1') threadCount = 1;
-        else if(c == '2') threadCount = 2;
-        else if(c == '3') threadCount = 3;
-        else if(c == '4') threadCount = 4;
-        else if(c == '5') threadCount = 5;
-        else if(c == '6') threadCount = 6;
-        else if(c == '7') threadCount = 7;
-        else if(c == '8') threadCount = 8;
+        if(c >= '1' && c <= '9') threadCount = c - '0' < maxThreads ? c - '0' : maxThreads;
+        else if(c == '0') threadCount = maxThreads;
 
         //Determine movement information
         switch(c){
@@ -230,7 +434,11 @@ int main( int argc, char *argv[] )
             case 'x':       //Increase iter
                 maxiter+=50;
                 break;
+            case 'b':       //Speedup curve
+                speedupCurve(xmin, xmax, ymin, ymax, maxiter);
+                continue;
             case 'q':       //Quit
+                saveTrace();
                 exit(0);
                 break;
             default:
@@ -238,10 +446,12 @@ int main( int argc, char *argv[] )
 
         }
 
-        //Create the image
+        //Create the image, with the framebuffer's pages placed for this many threads first
+        placeFramebuffer(threadCount);
+        double start = now();
         createThreads(threadCount, xmin, xmax, ymin, ymax, maxiter);
         //Let the people know we made it
-        printf("Computed\n");
+        printf("Computed with %d threads in %.4f seconds\n", threadCount, now() - start);
 	}
 
 	return 0;
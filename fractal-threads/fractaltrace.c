@@ -0,0 +1,44 @@
+/*
+fractaltrace.c - Turn a trace from fractalthread, fractaltask or
+fractalbench -T into something readable.  JSON lists every event and
+each thread's totals; the Chrome format opens in chrome://tracing or
+ui.perfetto.dev as one track per thread.
+*/
+
+#include "trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+//Print how to run it
+void usage(){
+    fprintf(stderr, "use: fractaltrace [-json|-chrome] tracefile\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    int chrome = 0;
+    const char *path = 0;
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-json")) chrome = 0;
+        else if(!strcmp(argv[i], "-chrome")) chrome = 1;
+        else if(!path && argv[i][0] != '-') path = argv[i];
+        else usage();
+    }
+    if(!path) usage();
+
+    errno = 0;
+    struct trace *trace = trace_load(path);
+    if(!trace){
+        fprintf(stderr, "fractaltrace: unable to read %s: %s\n", path, errno ? strerror(errno) : "not a trace");
+        exit(1);
+    }
+
+    if(chrome) trace_write_chrome(trace, stdout);
+    else trace_write_json(trace, stdout);
+
+    trace_delete(trace);
+    return 0;
+}
@@ -0,0 +1,340 @@
+/*
+fractalzoom.c - Render a Mandelbrot zoom to a video or a series of images.
+Goes from a start view to an end view in a given number of frames with
+the tile renderer, and writes them as Y4M or PPM.  A writer thread
+converts and writes each frame while the renderer gets on with the next.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mandel.h"
+#include "pool.h"
+#include "render.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+//How the frames go out: one Y4M video, numbered PPM files, or PPM images one after another
+#define OUTPUT_Y4M 0
+#define OUTPUT_PPM_FILES 1
+#define OUTPUT_PPM_STREAM 2
+
+//The writer thread and the two frames it takes turns with the renderer on
+struct writer{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    int width;
+    int height;
+    int fps;
+    int format;
+    const char *name;
+    FILE *file;
+
+    //A frame in each buffer, and the number of the frame it holds, or -1 once written
+    unsigned int *frames[2];
+    int number[2];
+    int finished;
+
+    //Scratch for one frame converted to the output format
+    unsigned char *out;
+
+    //Set if a write failed, which stops the renderer too
+    int failed;
+};
+
+//Current time in seconds
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+//Convert a frame to Y4M's planar 4:4:4 YCbCr with the BT.601 video range and write it
+int writeY4M(struct writer *w, const unsigned int *pixels){
+    int n = w->width*w->height;
+    unsigned char *y = w->out;
+    unsigned char *cb = y + n;
+    unsigned char *cr = cb + n;
+
+    for(int k = 0; k < n; k++){
+        int r = (pixels[k] >> 16) & 0xff;
+        int g = (pixels[k] >> 8) & 0xff;
+        int b = pixels[k] & 0xff;
+
+        //Offset before shifting so nothing negative is shifted
+        y[k] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+        cb[k] = (-38*r - 74*g + 112*b + 128 + 32768) >> 8;
+        cr[k] = (112*r - 94*g - 18*b + 128 + 32768) >> 8;
+    }
+
+    fputs("FRAME\n", w->file);
+    return fwrite(w->out, 1, 3*n, w->file) == (size_t)(3*n);
+}
+
+//Write a frame as a binary PPM image
+int writePPM(struct writer *w, FILE *file, const unsigned int *pixels){
+    int n = w->width*w->height;
+
+    for(int k = 0; k < n; k++){
+        w->out[3*k] = pixels[k] >> 16;
+        w->out[3*k+1] = pixels[k] >> 8;
+        w->out[3*k+2] = pixels[k];
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", w->width, w->height);
+    return fwrite(w->out, 1, 3*n, file) == (size_t)(3*n);
+}
+
+//Write one frame in whatever format was asked for
+int writeFrame(struct writer *w, int number, const unsigned int *pixels){
+    if(w->format == OUTPUT_Y4M) return writeY4M(w, pixels);
+    if(w->format == OUTPUT_PPM_STREAM) return writePPM(w, w->file, pixels);
+
+    char name[4096];
+    snprintf(name, sizeof(name), w->name, number);
+
+    FILE *file = fopen(name, "wb");
+    if(!file) return 0;
+    int ok = writePPM(w, file, pixels);
+    return fclose(file) == 0 && ok;
+}
+
+//Writer thread: write the frames in order as the renderer hands them over
+void *writerMain(void *arg){
+    struct writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for(int next = 0; ; next++){
+        int b = next % 2;
+        while(w->number[b] != next && !w->finished) pthread_cond_wait(&w->changed, &w->lock);
+        if(w->number[b] != next) break;
+
+        //The frame is ours until it is marked written, so the renderer can carry on meanwhile
+        pthread_mutex_unlock(&w->lock);
+        int ok = writeFrame(w, next, w->frames[b]);
+        pthread_mutex_lock(&w->lock);
+
+        if(!ok) w->failed = 1;
+        w->number[b] = -1;
+        pthread_cond_broadcast(&w->changed);
+        if(w->failed) break;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+//Hand a rendered frame to the writer, once the buffer it goes in has been written. Return 0 if writing has failed.
+int handOver(struct writer *w, int number, const unsigned int *pixels){
+    int b = number % 2;
+
+    pthread_mutex_lock(&w->lock);
+    while(w->number[b] != -1 && !w->failed) pthread_cond_wait(&w->changed, &w->lock);
+    int ok = !w->failed;
+    pthread_mutex_unlock(&w->lock);
+    if(!ok) return 0;
+
+    memcpy(w->frames[b], pixels, w->width*w->height*sizeof(unsigned int));
+
+    pthread_mutex_lock(&w->lock);
+    w->number[b] = number;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+
+    return 1;
+}
+
+/*
+Work out frame k of n between the start and end views.  The width and
+height shrink by the same factor every frame, so the zoom looks steady,
+and the center moves in step with the shrinking, so a point that is
+still on screen at the end stays put on screen all the way there.
+*/
+
+void zoomView(const double *from, const double *to, int k, int n, double *view){
+    double t = n > 1 ? (double)k/(n-1) : 0;
+
+    for(int axis = 0; axis < 2; axis++){
+        double span0 = from[2*axis+1] - from[2*axis];
+        double span1 = to[2*axis+1] - to[2*axis];
+        double c0 = (from[2*axis] + from[2*axis+1])/2;
+        double c1 = (to[2*axis] + to[2*axis+1])/2;
+
+        double span = span0*pow(span1/span0, t);
+        double s = fabs(span1 - span0) > 1e-12*fabs(span0) ? (span0 - span)/(span0 - span1) : t;
+        double c = c0 + (c1 - c0)*s;
+
+        view[2*axis] = c - span/2;
+        view[2*axis+1] = c + span/2;
+    }
+}
+
+//Print how to run the zoom
+void usage(){
+    fprintf(stderr, "use: fractalzoom [-a] [-g] [-s] [-t] [-A samples] [-j threads] [-w width] [-h height] [-n frames] [-f fps]\n");
+    fprintf(stderr, "                 [-m maxiter] [-M end-maxiter] [-from xmin xmax ymin ymax] [-to xmin xmax ymin ymax]\n");
+    fprintf(stderr, "                 [-julia kr ki] [-power n] -o output\n");
+    fprintf(stderr, "output is a .y4m file, - for Y4M on stdout, a name with %%d for numbered PPM files, or anything else for PPMs back to back\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[]){
+    //From the view the programs start with down to seahorse valley
+    double from[4] = { -1.5, 0.5, -1.0, 1.0 };
+    double to[4] = { -0.7454, -0.7452, 0.1130, 0.1132 };
+    int maxiter = 500;
+    int endMaxiter = 0;
+    int width = 640;
+    int height = 480;
+    int frames = 100;
+    int fps = 30;
+    int threads = 0;
+    int subdivide = 0;
+    int tiered = 0;
+    int scheme = PALETTE_GRAY;
+    int antialias = 0;
+    struct mandel_formula formula = { MANDEL_MULTIBROT, 2, 0, 0 };
+    int useFormula = 0;
+    const char *output = 0;
+
+    mandel_init();
+
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "-a")) mandel_set_accelerated(1);
+        else if(!strcmp(argv[i], "-s")) subdivide = 1;
+        else if(!strcmp(argv[i], "-t")) tiered = 1;
+        else if(!strcmp(argv[i], "-g")) scheme = PALETTE_GRADIENT;
+        else if(!strcmp(argv[i], "-A") && i+1 < argc) antialias = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-w") && i+1 < argc) width = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-h") && i+1 < argc) height = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-n") && i+1 < argc) frames = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-f") && i+1 < argc) fps = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-m") && i+1 < argc) maxiter = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-M") && i+1 < argc) endMaxiter = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-o") && i+1 < argc) output = argv[++i];
+        else if(!strcmp(argv[i], "-from") && i+4 < argc) for(int k = 0; k < 4; k++) from[k] = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-to") && i+4 < argc) for(int k = 0; k < 4; k++) to[k] = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-julia") && i+2 < argc){
+            formula.family = MANDEL_JULIA;
+            formula.kr = atof(argv[++i]);
+            formula.ki = atof(argv[++i]);
+            useFormula = 1;
+        }
+        else if(!strcmp(argv[i], "-power") && i+1 < argc){
+            formula.power = atoi(argv[++i]);
+            useFormula = 1;
+        }
+        else usage();
+    }
+    if(!output || width < 1 || height < 1 || frames < 1 || fps < 1 || maxiter < 1) usage();
+    if(antialias && (antialias < 2 || antialias > RENDER_AA_MAX)) usage();
+    if(formula.power < 2 || formula.power > MANDEL_MAX_POWER) usage();
+    if(from[1] <= from[0] || from[3] <= from[2] || to[1] <= to[0] || to[3] <= to[2]) usage();
+    if(endMaxiter < 1) endMaxiter = maxiter;
+    if(threads < 1) threads = pool_cpus();
+
+    struct writer w;
+    memset(&w, 0, sizeof(w));
+    w.width = width;
+    w.height = height;
+    w.fps = fps;
+    w.name = output;
+    w.number[0] = w.number[1] = -1;
+
+    int len = strlen(output);
+    if(!strcmp(output, "-") || (len > 4 && !strcmp(output + len - 4, ".y4m"))) w.format = OUTPUT_Y4M;
+    else if(strchr(output, '%')) w.format = OUTPUT_PPM_FILES;
+    else w.format = OUTPUT_PPM_STREAM;
+
+    if(w.format != OUTPUT_PPM_FILES){
+        w.file = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+        if(!w.file){
+            fprintf(stderr, "fractalzoom: unable to open %s: %s\n", output, strerror(errno));
+            return 1;
+        }
+    }
+    if(w.format == OUTPUT_Y4M) fprintf(w.file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+
+    struct render *renderer = render_create(width, height, threads);
+    w.frames[0] = malloc(width*height*sizeof(unsigned int));
+    w.frames[1] = malloc(width*height*sizeof(unsigned int));
+    w.out = malloc(3*width*height);
+    if(!renderer || !w.frames[0] || !w.frames[1] || !w.out){
+        fprintf(stderr, "fractalzoom: unable to allocate frames: %s\n", strerror(errno));
+        return 1;
+    }
+    renderer->subdivide = subdivide;
+    renderer->tiered = tiered;
+    renderer->scheme = scheme;
+    renderer->antialias = antialias;
+
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.changed, NULL);
+    if(pthread_create(&w.thread, NULL, writerMain, &w)){
+        fprintf(stderr, "fractalzoom: unable to start the writer: %s\n", strerror(errno));
+        return 1;
+    }
+
+    //Progress goes to stderr, since the video may be going to stdout
+    fprintf(stderr, "kernel: %s%s\n", mandel_kernel_name(), mandel_accelerated() ? " (accelerated)" : "");
+    fprintf(stderr, "frames: %d at %dx%d with %d threads\n", frames, width, height, threads);
+
+    double start = now();
+    double computing = 0;
+    int ok = 1;
+
+    for(int k = 0; k < frames && ok; k++){
+        double v[4];
+        zoomView(from, to, k, frames, v);
+
+        struct render_view view;
+        view.xmin = v[0];
+        view.xmax = v[1];
+        view.ymin = v[2];
+        view.ymax = v[3];
+        view.orbit = 0;
+        view.formula = useFormula ? &formula : 0;
+
+        //maxiter grows with the zoom the same way the view shrinks
+        double t = frames > 1 ? (double)k/(frames-1) : 0;
+        view.maxiter = (int)round(maxiter*pow((double)endMaxiter/maxiter, t));
+
+        double begin = now();
+        render_image(renderer, &view, threads);
+        computing += now() - begin;
+
+        ok = handOver(&w, k, renderer->pixels);
+    }
+
+    //Let the writer finish what it has and stop
+    pthread_mutex_lock(&w.lock);
+    w.finished = 1;
+    pthread_cond_broadcast(&w.changed);
+    pthread_mutex_unlock(&w.lock);
+    pthread_join(w.thread, NULL);
+
+    if(w.file && w.file != stdout && fclose(w.file)) w.failed = 1;
+    else if(w.file == stdout && fflush(stdout)) w.failed = 1;
+
+    if(w.failed){
+        fprintf(stderr, "fractalzoom: unable to write %s: %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    double elapsed = now() - start;
+    fprintf(stderr, "Rendered %d frames in %.4f seconds, %.4f of them computing\n", frames, elapsed, computing);
+
+    render_delete(renderer);
+    free(w.frames[0]);
+    free(w.frames[1]);
+    free(w.out);
+
+    return 0;
+}
@@ -2,6 +2,9 @@
 A simple graphics library for CSE 20211 by Douglas Thain
 For complete documentation, see:
 http://www.nd.edu/~dthain/courses/cse20211/fall2011/gfx
+version 7, 10/18/2026 - gfx_event_waiting keeps resizes and skips keys gfx_wait would not return.
+version 6, 10/18/2026 - Colormap displays allocate each color once instead of for every pixel.
+version 5, 10/18/2026 - Added gfx_put_image to draw a whole pixel buffer at once.
 version 4, 01/29/2020 - Added missing window size functions and fixed key lookup.
 Version 4, 01/20/2020 - Added missing window size functions.
 Version 3, 11/07/2012 - Now much faster at changing colors rapidly.
@@ -26,6 +29,8 @@ static Display *gfx_display=0;
 static Window  gfx_window;
 static GC      gfx_gc;
 static Colormap gfx_colormap;
+static Visual  *gfx_visual;
+static int      gfx_depth;
 static int      gfx_fast_color_mode = 0;
 
 /* These values are saved by gfx_wait then retrieved later by gfx_xpos and gfx_ypos. */
@@ -46,6 +51,8 @@ void gfx_open( int width, int height, const char *title )
 	}
 
 	Visual *visual = DefaultVisual(gfx_display,0);
+	gfx_visual = visual;
+	gfx_depth = DefaultDepth(gfx_display,0);
 	if(visual && visual->class==TrueColor) {
 		gfx_fast_color_mode = 1;
 	} else {
@@ -94,6 +101,76 @@ void gfx_point( int x, int y )
 	XDrawPoint(gfx_display,gfx_window,gfx_gc,x,y);
 }
 
+/* Slots in the cache of colors already allocated from the colormap; a power of two. */
+#define GFX_COLOR_CACHE 4096
+
+/* Convert a 0xRRGGBB value into a pixel value for the display. */
+
+static unsigned long gfx_pixel_value( unsigned int rgb )
+{
+	static unsigned int cache_rgb[GFX_COLOR_CACHE];
+	static unsigned long cache_pixel[GFX_COLOR_CACHE];
+	static char cache_valid[GFX_COLOR_CACHE];
+
+	rgb &= 0xffffff;
+	if(gfx_fast_color_mode) return rgb;
+
+	/* Colormap allocation is a round trip, so each color is only asked for once, unless two share a slot. */
+	unsigned int slot = (rgb*2654435761u)>>20 & (GFX_COLOR_CACHE-1);
+	if(cache_valid[slot] && cache_rgb[slot]==rgb) return cache_pixel[slot];
+
+	XColor color;
+	color.pixel = 0;
+	color.red = ((rgb>>16)&0xff)<<8;
+	color.green = ((rgb>>8)&0xff)<<8;
+	color.blue = (rgb&0xff)<<8;
+	XAllocColor(gfx_display,gfx_colormap,&color);
+
+	cache_rgb[slot] = rgb;
+	cache_pixel[slot] = color.pixel;
+	cache_valid[slot] = 1;
+	return color.pixel;
+}
+
+/* Draw a width x height buffer of 0xRRGGBB pixels at the top left corner in a single request. */
+
+void gfx_put_image( const unsigned int *pixels, int width, int height )
+{
+	XImage *image;
+	int x, y;
+
+	if(width<=0 || height<=0) return;
+
+	image = XCreateImage(gfx_display,gfx_visual,gfx_depth,ZPixmap,0,0,width,height,32,0);
+	if(!image) return;
+
+	if(gfx_fast_color_mode && image->bits_per_pixel==32) {
+		/* The buffer already has the layout of the image, so hand it over as-is in host byte order. */
+		union { unsigned int i; char c; } order = { 1 };
+		image->byte_order = order.c ? LSBFirst : MSBFirst;
+		image->data = (char *) pixels;
+		XPutImage(gfx_display,gfx_window,gfx_gc,image,0,0,0,0,width,height);
+	} else {
+		/* Otherwise, convert each pixel into a private buffer before sending it. */
+		image->data = malloc(image->bytes_per_line*height);
+		if(!image->data) {
+			XDestroyImage(image);
+			return;
+		}
+		for(y=0;y<height;y++) {
+			for(x=0;x<width;x++) {
+				XPutPixel(image,x,y,gfx_pixel_value(pixels[y*width+x]));
+			}
+		}
+		XPutImage(gfx_display,gfx_window,gfx_gc,image,0,0,0,0,width,height);
+		free(image->data);
+	}
+
+	/* The image does not own the pixel data, so detach it before destroying the image. */
+	image->data = 0;
+	XDestroyImage(image);
+}
+
 /* Draw a line from (x1,y1) to (x2,y2) */
 
 void gfx_line( int x1, int y1, int x2, int y2 )
@@ -105,21 +182,8 @@ void gfx_line( int x1, int y1, int x2, int y2 )
 
 void gfx_color( int r, int g, int b )
 {
-	XColor color;
-
-	if(gfx_fast_color_mode) {
-		/* If this is a truecolor display, we can just pick the color directly. */
-		color.pixel = ((b&0xff) | ((g&0xff)<<8) | ((r&0xff)<<16) );
-	} else {
-		/* Otherwise, we have to allocate it from the colormap of the display. */
-		color.pixel = 0;
-		color.red = r<<8;
-		color.green = g<<8;
-		color.blue = b<<8;
-		XAllocColor(gfx_display,gfx_colormap,&color);
-	}
-
-	XSetForeground(gfx_display, gfx_gc, color.pixel);
+	/* On a truecolor display this is the color itself; otherwise it comes from the colormap, once per color. */
+	XSetForeground(gfx_display, gfx_gc, gfx_pixel_value(((r&0xff)<<16) | ((g&0xff)<<8) | (b&0xff)));
 }
 
 /* Clear the graphics window to the background color. */
@@ -145,27 +209,47 @@ void gfx_clear_color( int r, int g, int b )
 	XChangeWindowAttributes(gfx_display,gfx_window,CWBackPixel,&attr);
 }
 
+/* Return what gfx_wait returns for a key, or 0 for a key such as shift that it skips. */
+
+static int gfx_key_code( XKeyEvent *key )
+{
+	KeySym symbol;
+	char str[4];
+	int r = XLookupString(key,str,sizeof(str),&symbol,0);
+
+	/* If the key sequence maps to an ascii character, return that. */
+	if(r==1) return str[0];
+
+	/* Special case for navigation keys, return codes above 129. */
+	if(symbol>=0xff50 && symbol<=0xff58) {
+		return 129 + (symbol-0xff50);
+	}
+
+	return 0;
+}
+
+/* Return true if gfx_wait would return right away, skipping over anything it would ignore. */
+
 int gfx_event_waiting()
 {
-       XEvent event;
+	XEvent event;
+
+	gfx_flush();
 
-       gfx_flush();
+	while(XCheckMaskEvent(gfx_display,-1,&event)) {
+		if(event.type==KeyPress && gfx_key_code(&event.xkey)) {
+			XPutBackEvent(gfx_display,&event);
+			return 1;
+		} else if(event.type==ButtonPress) {
+			XPutBackEvent(gfx_display,&event);
+			return 1;
+		} else if(event.type==ConfigureNotify) {
+			saved_xsize = event.xconfigure.width;
+			saved_ysize = event.xconfigure.height;
+		}
+	}
 
-       while (1) {
-               if(XCheckMaskEvent(gfx_display,-1,&event)) {
-                       if(event.type==KeyPress) {
-                               XPutBackEvent(gfx_display,&event);
-                               return 1;
-                       } else if (event.type==ButtonPress) {
-                               XPutBackEvent(gfx_display,&event);
-                               return 1;
-                       } else {
-                               return 0;
-                       }
-               } else {
-                       return 0;
-               }
-       }
+	return 0;
 }
 
 /* Wait for the user to press a key or mouse button. */
@@ -183,16 +267,8 @@ int gfx_wait()
 			saved_xpos = event.xkey.x;
 			saved_ypos = event.xkey.y;
 
-			/* If the key sequence maps to an ascii character, return that. */
-			KeySym symbol;
-			char str[4];
-			int r = XLookupString(&event.xkey,str,sizeof(str),&symbol,0);
-			if(r==1) return str[0];
-
-			/* Special case for navigation keys, return codes above 129. */
-			if(symbol>=0xff50 && symbol<=0xff58) {
-				return 129 + (symbol-0xff50);
-			}
+			int c = gfx_key_code(&event.xkey);
+			if(c) return c;
 
 		} else if(event.type==ButtonPress) {
 			saved_xpos = event.xkey.x;
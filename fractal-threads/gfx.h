@@ -3,6 +3,9 @@ A simple graphics library for CSE 20211 by Douglas Thain
 For course assignments, you should not change this file.
 For complete documentation, see:
 http://www.nd.edu/~dthain/courses/cse20211/fall2011/gfx
+version 7, 10/18/2026 - gfx_event_waiting keeps resizes and skips keys gfx_wait would not return.
+version 6, 10/18/2026 - Colormap displays allocate each color once instead of for every pixel.
+version 5, 10/18/2026 - Added gfx_put_image to draw a whole pixel buffer at once.
 version 4, 01/29/2020 - Added missing window size functions and fixed key lookup.
 Version 3, 11/07/2012 - Now much faster at changing colors rapidly.
 Version 2, 9/23/2011 - Fixes a bug that could result in jerky animation.
@@ -17,6 +20,9 @@ void gfx_open( int width, int height, const char *title );
 /* Draw a point at (x,y) */
 void gfx_point( int x, int y );
 
+/* Draw a width x height buffer of 0xRRGGBB pixels at the top left corner in a single request. */
+void gfx_put_image( const unsigned int *pixels, int width, int height );
+
 /* Draw a line from (x1,y1) to (x2,y2) */
 void gfx_line( int x1, int y1, int x2, int y2 );
 
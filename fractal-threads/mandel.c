@@ -0,0 +1,1006 @@
+/*
+mandel.c - Mandelbrot escape time kernels shared by the fractal programs.
+
+This computes the Mandelbrot fractal:
+z = z^2 + alpha
+
+Where z is initially zero, and alpha is the location x + iy
+in the complex plane.  Instead of the complex type with cpow()
+and cabs(), the square is written out with real and imaginary
+parts, and the bailout compares the squared magnitude against 16,
+so each iteration is just a few multiplies and adds.
+
+The vector kernels perform the same operations in the same order
+as mandel_point, one pixel per lane, so they give exactly the same
+iteration counts.  Do not build this with -ffast-math or with
+floating point contraction, or that stops being true.
+
+Accelerated mode skips most of the work for points inside the set.
+Points in the main cardioid or the period 2 bulb are recognized
+with a formula and never iterated.  For the rest, z is saved at
+growing intervals (Brent's method) and compared with later values;
+an exact match means the orbit has become a cycle that can never
+escape, so the point gets the maximum right away.  Because the match
+is exact, cycle detection never changes a count.
+
+For deep zooms, a pixel at c = C+dc is iterated as its offset dz from
+a reference orbit Z at C, computed beforehand in higher precision:
+dz' = (2Z+dz)dz + dc, where the offsets stay small enough for doubles
+long after c itself no longer fits in one.  When the pixel's own z gets
+closer to zero than its offset, or the reference runs out, the pixel is
+rebased: z becomes its new offset and the reference starts over from Z=0.
+That keeps dz small compared to z, which is what goes wrong in a glitch.
+
+mandel_pixels comes in float, double and double-double tiers, all built
+from the one kernel in mandel_template.h.  Floats fill twice as many
+lanes as doubles, and double-doubles reach about twice as deep; the
+renderer picks the cheapest one that can still tell the pixels apart.
+
+The Julia and Multibrot kernels come from the same template, in doubles
+only.  There is one for each family and power, so z^n is a short fixed
+chain of multiplies rather than a call to cpow(), which works through
+logarithms and is many times slower.
+*/
+
+#include "mandel.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MANDEL_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*mandel_points_func)( const double *xs, const double *ys, int n, int max, int *iters );
+typedef void (*mandel_resume_func)( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters );
+typedef void (*mandel_pixels_func)( const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters );
+
+static void mandel_points_scalar( const double *xs, const double *ys, int n, int max, int *iters );
+static void mandel_points_scalar_accel( const double *xs, const double *ys, int n, int max, int *iters );
+static void mandel_resume_scalar( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters );
+static void mandel_resume_scalar_accel( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters );
+
+/* The chosen kernels, plain and accelerated. */
+static mandel_points_func mandel_kernels[2] = { mandel_points_scalar, mandel_points_scalar_accel };
+static mandel_resume_func mandel_resume_kernels[2] = { mandel_resume_scalar, mandel_resume_scalar_accel };
+static const char *mandel_kernel_label = "scalar";
+static int mandel_accel = 0;
+
+/* The first checkpoint for cycle detection.  The interval doubles after every checkpoint. */
+#define MANDEL_CYCLE_START 8
+
+/* mandel_row works out the coordinates of this many pixels at a time. */
+#define MANDEL_CHUNK 256
+
+/*
+A tier is good enough while a pixel is at least this many units in the
+last place of the coordinates, so rounding stays well below a pixel
+even after it builds up over many iterations.
+*/
+#define MANDEL_TIER_ULPS 1024.0
+
+/* Return the number of iterations at x+iy, up to a maximum of max. */
+
+int mandel_point( double x, double y, int max )
+{
+	double zr = 0;
+	double zi = 0;
+
+	int iter = 0;
+
+	while( zr*zr + zi*zi < 16 && iter < max ) {
+		double t = zr*zr - zi*zi + x;
+		zi = 2*zr*zi + y;
+		zr = t;
+		iter++;
+	}
+
+	return iter;
+}
+
+/* Return true if x+iy is inside the main cardioid or the period 2 bulb. */
+
+static int mandel_interior( double x, double y )
+{
+	double y2 = y*y;
+	double xq = x-0.25;
+	double q = xq*xq + y2;
+
+	if(q*(q+xq) <= 0.25*y2) return 1;
+	if((x+1)*(x+1) + y2 <= 0.0625) return 1;
+	return 0;
+}
+
+int mandel_point_accelerated( double x, double y, int max )
+{
+	if(mandel_interior(x,y)) return max;
+
+	double zr = 0;
+	double zi = 0;
+	double sr = 0;
+	double si = 0;
+
+	int iter = 0;
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	while( zr*zr + zi*zi < 16 && iter < max ) {
+		double t = zr*zr - zi*zi + x;
+		zi = 2*zr*zi + y;
+		zr = t;
+		iter++;
+
+		/* Back where it was at the last checkpoint, so it will go round forever. */
+		if(zr==sr && zi==si) return max;
+
+		if(++period==limit) {
+			period = 0;
+			limit *= 2;
+			sr = zr;
+			si = zi;
+		}
+	}
+
+	return iter;
+}
+
+static void mandel_points_scalar( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	for(int i=0;i<n;i++) iters[i] = mandel_point(xs[i],ys[i],max);
+}
+
+static void mandel_points_scalar_accel( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	for(int i=0;i<n;i++) iters[i] = mandel_point_accelerated(xs[i],ys[i],max);
+}
+
+/*
+Carry one point on from a saved z and iteration count, and save where it stops.
+A NAN in zr marks a point already known never to escape.  In accelerated
+mode, a fresh point in the cardioid or bulb, or one that cycles, gets that mark.
+Cycle checkpoints start over from wherever the point resumes, which is
+fine because only an exact repeat counts as a cycle.
+*/
+
+static void mandel_resume_point( double x, double y, int max, double *pzr, double *pzi, int *piter, const int accel )
+{
+	double zr = *pzr;
+	double zi = *pzi;
+	int iter = *piter;
+
+	if(zr!=zr || (accel && iter==0 && mandel_interior(x,y))) {
+		*pzr = NAN;
+		*piter = max;
+		return;
+	}
+
+	double sr = zr;
+	double si = zi;
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	while( zr*zr + zi*zi < 16 && iter < max ) {
+		double t = zr*zr - zi*zi + x;
+		zi = 2*zr*zi + y;
+		zr = t;
+		iter++;
+
+		if(accel) {
+			if(zr==sr && zi==si) {
+				*pzr = NAN;
+				*piter = max;
+				return;
+			}
+
+			if(++period==limit) {
+				period = 0;
+				limit *= 2;
+				sr = zr;
+				si = zi;
+			}
+		}
+	}
+
+	*pzr = zr;
+	*pzi = zi;
+	*piter = iter;
+}
+
+static void mandel_resume_scalar( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	for(int i=0;i<n;i++) mandel_resume_point(xs[i],ys[i],max,&zrs[i],&zis[i],&iters[i],0);
+}
+
+static void mandel_resume_scalar_accel( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	for(int i=0;i<n;i++) mandel_resume_point(xs[i],ys[i],max,&zrs[i],&zis[i],&iters[i],1);
+}
+
+/* Return the number of iterations at the offset dcr+i*dci from the orbit's reference point. */
+
+static int mandel_perturbed_point( const struct mandel_orbit *o, double dcr, double dci, int max )
+{
+	double dzr = 0;
+	double dzi = 0;
+	int n = 0;
+	int iter = 0;
+
+	while(iter<max) {
+		double zr = o->zr[n] + dzr;
+		double zi = o->zi[n] + dzi;
+		double mag = zr*zr + zi*zi;
+
+		if(mag>=16) break;
+
+		/* Rebase onto the start of the orbit, so the offset is the whole z. */
+		if(mag < dzr*dzr + dzi*dzi || n==o->length) {
+			dzr = zr;
+			dzi = zi;
+			n = 0;
+		}
+
+		double ar = 2*o->zr[n] + dzr;
+		double ai = 2*o->zi[n] + dzi;
+		double t = ar*dzr - ai*dzi + dcr;
+		dzi = ar*dzi + ai*dzr + dci;
+		dzr = t;
+		n++;
+		iter++;
+	}
+
+	return iter;
+}
+
+#ifdef MANDEL_X86
+
+/*
+Four points at a time.  The iteration counts are kept as doubles so they can be masked like everything else.
+The accel flag is always a constant, so each wrapper below gets its own copy with the unused code removed.
+*/
+
+__attribute__((target("avx2"),always_inline))
+static inline __m256d mandel_group_avx2( __m256d cr, __m256d ci, int max, const int accel )
+{
+	const __m256d one = _mm256_set1_pd(1);
+	const __m256d two = _mm256_set1_pd(2);
+	const __m256d sixteen = _mm256_set1_pd(16);
+	const __m256d vmax = _mm256_set1_pd(max);
+	const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+	__m256d zr = _mm256_setzero_pd();
+	__m256d zi = _mm256_setzero_pd();
+	__m256d sr = _mm256_setzero_pd();
+	__m256d si = _mm256_setzero_pd();
+	__m256d count = _mm256_setzero_pd();
+	__m256d active = all;
+
+	if(accel) {
+		/* Lanes in the cardioid or the bulb are done before they start. */
+		__m256d y2 = _mm256_mul_pd(ci,ci);
+		__m256d xq = _mm256_sub_pd(cr,_mm256_set1_pd(0.25));
+		__m256d q = _mm256_add_pd(_mm256_mul_pd(xq,xq),y2);
+		__m256d card = _mm256_cmp_pd(_mm256_mul_pd(q,_mm256_add_pd(q,xq)),_mm256_mul_pd(_mm256_set1_pd(0.25),y2),_CMP_LE_OQ);
+		__m256d x1 = _mm256_add_pd(cr,one);
+		__m256d bulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(x1,x1),y2),_mm256_set1_pd(0.0625),_CMP_LE_OQ);
+		__m256d inside = _mm256_or_pd(card,bulb);
+		count = _mm256_and_pd(inside,vmax);
+		active = _mm256_andnot_pd(inside,all);
+	}
+
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	for(int k=0;k<max;k++) {
+		__m256d zr2 = _mm256_mul_pd(zr,zr);
+		__m256d zi2 = _mm256_mul_pd(zi,zi);
+
+		/* A lane stays inactive once it escapes, whatever its z does afterwards. */
+		active = _mm256_and_pd(active,_mm256_cmp_pd(_mm256_add_pd(zr2,zi2),sixteen,_CMP_LT_OQ));
+		if(!_mm256_movemask_pd(active)) break;
+		count = _mm256_add_pd(count,_mm256_and_pd(active,one));
+
+		__m256d t = _mm256_add_pd(_mm256_sub_pd(zr2,zi2),cr);
+		zi = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two,zr),zi),ci);
+		zr = t;
+
+		if(accel) {
+			/* Lanes that came back to their checkpoint exactly are cycling and get the maximum. */
+			__m256d cycle = _mm256_and_pd(active,_mm256_and_pd(_mm256_cmp_pd(zr,sr,_CMP_EQ_OQ),_mm256_cmp_pd(zi,si,_CMP_EQ_OQ)));
+			count = _mm256_blendv_pd(count,vmax,cycle);
+			active = _mm256_andnot_pd(cycle,active);
+
+			if(++period==limit) {
+				period = 0;
+				limit *= 2;
+				sr = zr;
+				si = zi;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* Full groups straight from the arrays, then the last few padded out with copies of the final point. */
+
+__attribute__((target("avx2"),always_inline))
+static inline void mandel_points_avx2_body( const double *xs, const double *ys, int n, int max, int *iters, const int accel )
+{
+	int i = 0;
+
+	for(;i+4<=n;i+=4) {
+		__m256d count = mandel_group_avx2(_mm256_loadu_pd(&xs[i]),_mm256_loadu_pd(&ys[i]),max,accel);
+		_mm_storeu_si128((__m128i *)&iters[i],_mm256_cvtpd_epi32(count));
+	}
+
+	if(i<n) {
+		double x[4], y[4];
+		int out[4];
+		for(int k=0;k<4;k++) {
+			x[k] = xs[i+k<n ? i+k : n-1];
+			y[k] = ys[i+k<n ? i+k : n-1];
+		}
+		__m256d count = mandel_group_avx2(_mm256_loadu_pd(x),_mm256_loadu_pd(y),max,accel);
+		_mm_storeu_si128((__m128i *)out,_mm256_cvtpd_epi32(count));
+		for(int k=0;i+k<n;k++) iters[i+k] = out[k];
+	}
+}
+
+__attribute__((target("avx2")))
+static void mandel_points_avx2( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	mandel_points_avx2_body(xs,ys,n,max,iters,0);
+}
+
+__attribute__((target("avx2")))
+static void mandel_points_avx2_accel( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	mandel_points_avx2_body(xs,ys,n,max,iters,1);
+}
+
+/*
+Resuming four points at a time.  The lanes may start at different counts,
+so z is saved off to the side as each lane escapes or reaches the
+maximum, which keeps the blends out of the loop's dependency chain.
+*/
+
+__attribute__((target("avx2"),always_inline))
+static inline void mandel_resume_group_avx2( __m256d cr, __m256d ci, int max, __m256d *pzr, __m256d *pzi, __m256d *pcount, const int accel )
+{
+	const __m256d one = _mm256_set1_pd(1);
+	const __m256d two = _mm256_set1_pd(2);
+	const __m256d sixteen = _mm256_set1_pd(16);
+	const __m256d vmax = _mm256_set1_pd(max);
+	const __m256d nan = _mm256_set1_pd(NAN);
+
+	__m256d zr = *pzr;
+	__m256d zi = *pzi;
+	__m256d count = *pcount;
+
+	__m256d known = _mm256_cmp_pd(zr,zr,_CMP_UNORD_Q);
+
+	if(accel) {
+		__m256d fresh = _mm256_andnot_pd(known,_mm256_cmp_pd(count,_mm256_setzero_pd(),_CMP_EQ_OQ));
+		__m256d y2 = _mm256_mul_pd(ci,ci);
+		__m256d xq = _mm256_sub_pd(cr,_mm256_set1_pd(0.25));
+		__m256d q = _mm256_add_pd(_mm256_mul_pd(xq,xq),y2);
+		__m256d card = _mm256_cmp_pd(_mm256_mul_pd(q,_mm256_add_pd(q,xq)),_mm256_mul_pd(_mm256_set1_pd(0.25),y2),_CMP_LE_OQ);
+		__m256d x1 = _mm256_add_pd(cr,one);
+		__m256d bulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(x1,x1),y2),_mm256_set1_pd(0.0625),_CMP_LE_OQ);
+		known = _mm256_or_pd(known,_mm256_and_pd(fresh,_mm256_or_pd(card,bulb)));
+		zr = _mm256_blendv_pd(zr,nan,known);
+	}
+
+	count = _mm256_blendv_pd(count,vmax,known);
+	__m256d active = _mm256_andnot_pd(known,_mm256_cmp_pd(count,vmax,_CMP_LT_OQ));
+
+	__m256d szr = zr;
+	__m256d szi = zi;
+	__m256d sr = zr;
+	__m256d si = zi;
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	while(_mm256_movemask_pd(active)) {
+		__m256d zr2 = _mm256_mul_pd(zr,zr);
+		__m256d zi2 = _mm256_mul_pd(zi,zi);
+
+		__m256d escaped = _mm256_andnot_pd(_mm256_cmp_pd(_mm256_add_pd(zr2,zi2),sixteen,_CMP_LT_OQ),active);
+		if(_mm256_movemask_pd(escaped)) {
+			szr = _mm256_blendv_pd(szr,zr,escaped);
+			szi = _mm256_blendv_pd(szi,zi,escaped);
+			active = _mm256_andnot_pd(escaped,active);
+			if(!_mm256_movemask_pd(active)) break;
+		}
+		count = _mm256_add_pd(count,_mm256_and_pd(active,one));
+
+		__m256d t = _mm256_add_pd(_mm256_sub_pd(zr2,zi2),cr);
+		zi = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two,zr),zi),ci);
+		zr = t;
+
+		if(accel) {
+			__m256d cycle = _mm256_and_pd(active,_mm256_and_pd(_mm256_cmp_pd(zr,sr,_CMP_EQ_OQ),_mm256_cmp_pd(zi,si,_CMP_EQ_OQ)));
+			count = _mm256_blendv_pd(count,vmax,cycle);
+			szr = _mm256_blendv_pd(szr,nan,cycle);
+			active = _mm256_andnot_pd(cycle,active);
+
+			if(++period==limit) {
+				period = 0;
+				limit *= 2;
+				sr = zr;
+				si = zi;
+			}
+		}
+
+		__m256d full = _mm256_and_pd(active,_mm256_cmp_pd(count,vmax,_CMP_EQ_OQ));
+		if(_mm256_movemask_pd(full)) {
+			szr = _mm256_blendv_pd(szr,zr,full);
+			szi = _mm256_blendv_pd(szi,zi,full);
+			active = _mm256_andnot_pd(full,active);
+		}
+	}
+
+	*pzr = szr;
+	*pzi = szi;
+	*pcount = count;
+}
+
+__attribute__((target("avx2"),always_inline))
+static inline void mandel_resume_avx2_body( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters, const int accel )
+{
+	for(int i=0;i<n;i+=4) {
+		double x[4], y[4], zr[4], zi[4];
+		int count[4];
+
+		/* Spare lanes in the last group repeat the final point. */
+		for(int k=0;k<4;k++) {
+			int p = i+k<n ? i+k : n-1;
+			x[k] = xs[p];
+			y[k] = ys[p];
+			zr[k] = zrs[p];
+			zi[k] = zis[p];
+			count[k] = iters[p];
+		}
+
+		__m256d vzr = _mm256_loadu_pd(zr);
+		__m256d vzi = _mm256_loadu_pd(zi);
+		__m256d vcount = _mm256_cvtepi32_pd(_mm_loadu_si128((__m128i *)count));
+
+		mandel_resume_group_avx2(_mm256_loadu_pd(x),_mm256_loadu_pd(y),max,&vzr,&vzi,&vcount,accel);
+
+		_mm256_storeu_pd(zr,vzr);
+		_mm256_storeu_pd(zi,vzi);
+		_mm_storeu_si128((__m128i *)count,_mm256_cvtpd_epi32(vcount));
+
+		for(int k=0;k<4 && i+k<n;k++) {
+			zrs[i+k] = zr[k];
+			zis[i+k] = zi[k];
+			iters[i+k] = count[k];
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void mandel_resume_avx2( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	mandel_resume_avx2_body(xs,ys,n,max,zrs,zis,iters,0);
+}
+
+__attribute__((target("avx2")))
+static void mandel_resume_avx2_accel( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	mandel_resume_avx2_body(xs,ys,n,max,zrs,zis,iters,1);
+}
+
+/* Eight points at a time, using a mask register to track which lanes are still iterating. */
+
+__attribute__((target("avx512f"),always_inline))
+static inline __m512d mandel_group_avx512( __m512d cr, __m512d ci, int max, const int accel )
+{
+	const __m512d one = _mm512_set1_pd(1);
+	const __m512d two = _mm512_set1_pd(2);
+	const __m512d sixteen = _mm512_set1_pd(16);
+	const __m512d vmax = _mm512_set1_pd(max);
+
+	__m512d zr = _mm512_setzero_pd();
+	__m512d zi = _mm512_setzero_pd();
+	__m512d sr = _mm512_setzero_pd();
+	__m512d si = _mm512_setzero_pd();
+	__m512d count = _mm512_setzero_pd();
+	__mmask8 active = 0xff;
+
+	if(accel) {
+		/* Lanes in the cardioid or the bulb are done before they start. */
+		__m512d y2 = _mm512_mul_pd(ci,ci);
+		__m512d xq = _mm512_sub_pd(cr,_mm512_set1_pd(0.25));
+		__m512d q = _mm512_add_pd(_mm512_mul_pd(xq,xq),y2);
+		__mmask8 card = _mm512_cmp_pd_mask(_mm512_mul_pd(q,_mm512_add_pd(q,xq)),_mm512_mul_pd(_mm512_set1_pd(0.25),y2),_CMP_LE_OQ);
+		__m512d x1 = _mm512_add_pd(cr,one);
+		__mmask8 bulb = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(x1,x1),y2),_mm512_set1_pd(0.0625),_CMP_LE_OQ);
+		__mmask8 inside = card | bulb;
+		count = _mm512_mask_mov_pd(count,inside,vmax);
+		active = ~inside;
+	}
+
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	for(int k=0;k<max;k++) {
+		__m512d zr2 = _mm512_mul_pd(zr,zr);
+		__m512d zi2 = _mm512_mul_pd(zi,zi);
+
+		active = _mm512_mask_cmp_pd_mask(active,_mm512_add_pd(zr2,zi2),sixteen,_CMP_LT_OQ);
+		if(!active) break;
+		count = _mm512_mask_add_pd(count,active,count,one);
+
+		__m512d t = _mm512_add_pd(_mm512_sub_pd(zr2,zi2),cr);
+		zi = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two,zr),zi),ci);
+		zr = t;
+
+		if(accel) {
+			__mmask8 cycle = _mm512_mask_cmp_pd_mask(active,zr,sr,_CMP_EQ_OQ) & _mm512_cmp_pd_mask(zi,si,_CMP_EQ_OQ);
+			count = _mm512_mask_mov_pd(count,cycle,vmax);
+			active &= ~cycle;
+
+			if(++period==limit) {
+				period = 0;
+				limit *= 2;
+				sr = zr;
+				si = zi;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* The last group is loaded through a mask, with the spare lanes holding copies of the final point. */
+
+__attribute__((target("avx512f"),always_inline))
+static inline void mandel_points_avx512_body( const double *xs, const double *ys, int n, int max, int *iters, const int accel )
+{
+	int i = 0;
+
+	for(;i+8<=n;i+=8) {
+		__m512d count = mandel_group_avx512(_mm512_loadu_pd(&xs[i]),_mm512_loadu_pd(&ys[i]),max,accel);
+		_mm256_storeu_si256((__m256i *)&iters[i],_mm512_cvtpd_epi32(count));
+	}
+
+	if(i<n) {
+		__mmask8 tail = (__mmask8)((1u<<(n-i))-1);
+		__m512d cr = _mm512_mask_loadu_pd(_mm512_set1_pd(xs[n-1]),tail,&xs[i]);
+		__m512d ci = _mm512_mask_loadu_pd(_mm512_set1_pd(ys[n-1]),tail,&ys[i]);
+		__m512d count = mandel_group_avx512(cr,ci,max,accel);
+		int out[8];
+		_mm256_storeu_si256((__m256i *)out,_mm512_cvtpd_epi32(count));
+		for(int k=0;i+k<n;k++) iters[i+k] = out[k];
+	}
+}
+
+__attribute__((target("avx512f")))
+static void mandel_points_avx512( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	mandel_points_avx512_body(xs,ys,n,max,iters,0);
+}
+
+__attribute__((target("avx512f")))
+static void mandel_points_avx512_accel( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	mandel_points_avx512_body(xs,ys,n,max,iters,1);
+}
+
+/* Resuming eight points at a time; see mandel_resume_group_avx2. */
+
+__attribute__((target("avx512f"),always_inline))
+static inline void mandel_resume_group_avx512( __m512d cr, __m512d ci, int max, __m512d *pzr, __m512d *pzi, __m512d *pcount, const int accel )
+{
+	const __m512d one = _mm512_set1_pd(1);
+	const __m512d two = _mm512_set1_pd(2);
+	const __m512d sixteen = _mm512_set1_pd(16);
+	const __m512d vmax = _mm512_set1_pd(max);
+	const __m512d nan = _mm512_set1_pd(NAN);
+
+	__m512d zr = *pzr;
+	__m512d zi = *pzi;
+	__m512d count = *pcount;
+
+	__mmask8 known = _mm512_cmp_pd_mask(zr,zr,_CMP_UNORD_Q);
+
+	if(accel) {
+		__mmask8 fresh = _mm512_cmp_pd_mask(count,_mm512_setzero_pd(),_CMP_EQ_OQ) & ~known;
+		__m512d y2 = _mm512_mul_pd(ci,ci);
+		__m512d xq = _mm512_sub_pd(cr,_mm512_set1_pd(0.25));
+		__m512d q = _mm512_add_pd(_mm512_mul_pd(xq,xq),y2);
+		__mmask8 card = _mm512_cmp_pd_mask(_mm512_mul_pd(q,_mm512_add_pd(q,xq)),_mm512_mul_pd(_mm512_set1_pd(0.25),y2),_CMP_LE_OQ);
+		__m512d x1 = _mm512_add_pd(cr,one);
+		__mmask8 bulb = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(x1,x1),y2),_mm512_set1_pd(0.0625),_CMP_LE_OQ);
+		known |= fresh & (card|bulb);
+		zr = _mm512_mask_mov_pd(zr,known,nan);
+	}
+
+	count = _mm512_mask_mov_pd(count,known,vmax);
+	__mmask8 active = _mm512_mask_cmp_pd_mask(~known,count,vmax,_CMP_LT_OQ);
+
+	__m512d szr = zr;
+	__m512d szi = zi;
+	__m512d sr = zr;
+	__m512d si = zi;
+	int period = 0;
+	int limit = MANDEL_CYCLE_START;
+
+	while(active) {
+		__m512d zr2 = _mm512_mul_pd(zr,zr);
+		__m512d zi2 = _mm512_mul_pd(zi,zi);
+
+		__mmask8 escaped = active & ~_mm512_mask_cmp_pd_mask(active,_mm512_add_pd(zr2,zi2),sixteen,_CMP_LT_OQ);
+		if(escaped) {
+			szr = _mm512_mask_mov_pd(szr,escaped,zr);
+			szi = _mm512_mask_mov_pd(szi,escaped,zi);
+			active &= ~escaped;
+			if(!active) break;
+		}
+		count = _mm512_mask_add_pd(count,active,count,one);
+
+		__m512d t = _mm512_add_pd(_mm512_sub_pd(zr2,zi2),cr);
+		zi = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two,zr),zi),ci);
+		zr = t;
+
+		if(accel) {
+			__mmask8 cycle = _mm512_mask_cmp_pd_mask(active,zr,sr,_CMP_EQ_OQ) & _mm512_cmp_pd_mask(zi,si,_CMP_EQ_OQ);
+			count = _mm512_mask_mov_pd(count,cycle,vmax);
+			szr = _mm512_mask_mov_pd(szr,cycle,nan);
+			active &= ~cycle;
+
+			if(++period==limit) {
+				period = 0;
+				limit *= 2;
+				sr = zr;
+				si = zi;
+			}
+		}
+
+		__mmask8 full = _mm512_mask_cmp_pd_mask(active,count,vmax,_CMP_EQ_OQ);
+		if(full) {
+			szr = _mm512_mask_mov_pd(szr,full,zr);
+			szi = _mm512_mask_mov_pd(szi,full,zi);
+			active &= ~full;
+		}
+	}
+
+	*pzr = szr;
+	*pzi = szi;
+	*pcount = count;
+}
+
+__attribute__((target("avx512f"),always_inline))
+static inline void mandel_resume_avx512_body( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters, const int accel )
+{
+	for(int i=0;i<n;i+=8) {
+		/* Spare lanes in the last group repeat the final point. */
+		__mmask8 lanes = n-i>=8 ? 0xff : (__mmask8)((1u<<(n-i))-1);
+
+		__m512d cr = _mm512_mask_loadu_pd(_mm512_set1_pd(xs[n-1]),lanes,&xs[i]);
+		__m512d ci = _mm512_mask_loadu_pd(_mm512_set1_pd(ys[n-1]),lanes,&ys[i]);
+		__m512d zr = _mm512_mask_loadu_pd(_mm512_set1_pd(zrs[n-1]),lanes,&zrs[i]);
+		__m512d zi = _mm512_mask_loadu_pd(_mm512_set1_pd(zis[n-1]),lanes,&zis[i]);
+		__m512i count32 = _mm512_mask_loadu_epi32(_mm512_set1_epi32(iters[n-1]),(__mmask16)lanes,&iters[i]);
+		__m512d count = _mm512_cvtepi32_pd(_mm512_castsi512_si256(count32));
+
+		mandel_resume_group_avx512(cr,ci,max,&zr,&zi,&count,accel);
+
+		_mm512_mask_storeu_pd(&zrs[i],lanes,zr);
+		_mm512_mask_storeu_pd(&zis[i],lanes,zi);
+		_mm512_mask_storeu_epi32(&iters[i],(__mmask16)lanes,_mm512_castsi256_si512(_mm512_cvtpd_epi32(count)));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void mandel_resume_avx512( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	mandel_resume_avx512_body(xs,ys,n,max,zrs,zis,iters,0);
+}
+
+__attribute__((target("avx512f")))
+static void mandel_resume_avx512_accel( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	mandel_resume_avx512_body(xs,ys,n,max,zrs,zis,iters,1);
+}
+
+#endif
+
+/* Work out min + i*(max-min)/size as a double-double hi+lo, exactly enough that neighbors never round together. */
+
+static void mandel_dd_coordinate( double min, double max, int size, int i, double *hi, double *lo )
+{
+	double span = max-min;
+
+	/* p = i*span exactly, splitting span in two halves since i fits in one. */
+	double t = span*134217729.0;
+	double sh = t-(t-span);
+	double sl = span-sh;
+	double ph = i*span;
+	double pl = ((i*sh-ph) + i*sl);
+
+	/* q = p/size, with the remainder divided again. */
+	double q1 = ph/size;
+	t = q1*134217729.0;
+	double qh = t-(t-q1);
+	double ql = q1-qh;
+	double m = q1*size;
+	double me = ((qh*size-m) + ql*size);
+	double q2 = ((ph-m) - me + pl)/size;
+
+	/* min + q1 + q2, keeping what the first sum rounds off. */
+	double s = min+q1;
+	double v = s-min;
+	double e = (min-(s-v)) + (q1-v) + q2;
+
+	*hi = s+e;
+	*lo = e-(*hi-s);
+}
+
+#define MANDEL_T_KIND MANDEL_FLOAT
+#define MANDEL_T_BYTES 16
+#define MANDEL_T_TARGET
+#define MANDEL_T_NAME(x) x##_float
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE
+#define MANDEL_T_BYTES 16
+#define MANDEL_T_TARGET
+#define MANDEL_T_NAME(x) x##_double
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE_DOUBLE
+#define MANDEL_T_BYTES 16
+#define MANDEL_T_TARGET
+#define MANDEL_T_NAME(x) x##_dd
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#ifdef MANDEL_X86
+
+#define MANDEL_T_KIND MANDEL_FLOAT
+#define MANDEL_T_BYTES 32
+#define MANDEL_T_TARGET __attribute__((target("avx2")))
+#define MANDEL_T_NAME(x) x##_float_avx2
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE
+#define MANDEL_T_BYTES 32
+#define MANDEL_T_TARGET __attribute__((target("avx2")))
+#define MANDEL_T_NAME(x) x##_double_avx2
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE_DOUBLE
+#define MANDEL_T_BYTES 32
+#define MANDEL_T_TARGET __attribute__((target("avx2")))
+#define MANDEL_T_NAME(x) x##_dd_avx2
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_FLOAT
+#define MANDEL_T_BYTES 64
+#define MANDEL_T_TARGET __attribute__((target("avx512f")))
+#define MANDEL_T_NAME(x) x##_float_avx512
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE
+#define MANDEL_T_BYTES 64
+#define MANDEL_T_TARGET __attribute__((target("avx512f")))
+#define MANDEL_T_NAME(x) x##_double_avx512
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+#define MANDEL_T_KIND MANDEL_DOUBLE_DOUBLE
+#define MANDEL_T_BYTES 64
+#define MANDEL_T_TARGET __attribute__((target("avx512f")))
+#define MANDEL_T_NAME(x) x##_dd_avx512
+#include "mandel_template.h"
+#undef MANDEL_T_KIND
+#undef MANDEL_T_BYTES
+#undef MANDEL_T_TARGET
+#undef MANDEL_T_NAME
+
+static const mandel_pixels_func mandel_tiers_avx2[3][2] = {
+	{ mandel_pixels_float_avx2, mandel_pixels_accel_float_avx2 },
+	{ mandel_pixels_double_avx2, mandel_pixels_accel_double_avx2 },
+	{ mandel_pixels_dd_avx2, mandel_pixels_accel_dd_avx2 },
+};
+
+static const mandel_pixels_func mandel_tiers_avx512[3][2] = {
+	{ mandel_pixels_float_avx512, mandel_pixels_accel_float_avx512 },
+	{ mandel_pixels_double_avx512, mandel_pixels_accel_double_avx512 },
+	{ mandel_pixels_dd_avx512, mandel_pixels_accel_dd_avx512 },
+};
+
+#endif
+
+static const mandel_pixels_func mandel_tiers_generic[3][2] = {
+	{ mandel_pixels_float, mandel_pixels_accel_float },
+	{ mandel_pixels_double, mandel_pixels_accel_double },
+	{ mandel_pixels_dd, mandel_pixels_accel_dd },
+};
+
+/* The tier kernels for the chosen instruction set, plain and accelerated. */
+static mandel_pixels_func mandel_tier_kernels[3][2];
+
+/* The formula kernels for the chosen instruction set, by family and power. */
+static mandel_formula_func mandel_formula_kernels[2][MANDEL_MAX_POWER+1];
+
+/* Pick the fastest kernel this CPU supports, unless MANDEL_KERNEL asks for a particular one. */
+
+void mandel_init()
+{
+	const char *want = getenv("MANDEL_KERNEL");
+
+	mandel_kernels[0] = mandel_points_scalar;
+	mandel_kernels[1] = mandel_points_scalar_accel;
+	mandel_resume_kernels[0] = mandel_resume_scalar;
+	mandel_resume_kernels[1] = mandel_resume_scalar_accel;
+	mandel_kernel_label = "scalar";
+	memcpy(mandel_tier_kernels,mandel_tiers_generic,sizeof(mandel_tier_kernels));
+	memcpy(mandel_formula_kernels,mandel_formulas_double,sizeof(mandel_formula_kernels));
+
+	if(want && !strcmp(want,"scalar")) return;
+
+#ifdef MANDEL_X86
+	__builtin_cpu_init();
+
+	if((!want || !strcmp(want,"avx512")) && __builtin_cpu_supports("avx512f")) {
+		mandel_kernels[0] = mandel_points_avx512;
+		mandel_kernels[1] = mandel_points_avx512_accel;
+		mandel_resume_kernels[0] = mandel_resume_avx512;
+		mandel_resume_kernels[1] = mandel_resume_avx512_accel;
+		memcpy(mandel_tier_kernels,mandel_tiers_avx512,sizeof(mandel_tier_kernels));
+		memcpy(mandel_formula_kernels,mandel_formulas_double_avx512,sizeof(mandel_formula_kernels));
+		mandel_kernel_label = "avx512";
+		return;
+	}
+
+	if((!want || !strcmp(want,"avx2") || !strcmp(want,"avx512")) && __builtin_cpu_supports("avx2")) {
+		mandel_kernels[0] = mandel_points_avx2;
+		mandel_kernels[1] = mandel_points_avx2_accel;
+		mandel_resume_kernels[0] = mandel_resume_avx2;
+		mandel_resume_kernels[1] = mandel_resume_avx2_accel;
+		memcpy(mandel_tier_kernels,mandel_tiers_avx2,sizeof(mandel_tier_kernels));
+		memcpy(mandel_formula_kernels,mandel_formulas_double_avx2,sizeof(mandel_formula_kernels));
+		mandel_kernel_label = "avx2";
+		return;
+	}
+#endif
+
+	if(want && strcmp(want,mandel_kernel_label)) {
+		fprintf(stderr,"mandel: %s kernel is not available, using %s\n",want,mandel_kernel_label);
+	}
+}
+
+const char *mandel_kernel_name()
+{
+	return mandel_kernel_label;
+}
+
+void mandel_set_accelerated( int on )
+{
+	mandel_accel = on ? 1 : 0;
+}
+
+int mandel_accelerated()
+{
+	return mandel_accel;
+}
+
+void mandel_points( const double *xs, const double *ys, int n, int max, int *iters )
+{
+	mandel_kernels[mandel_accel](xs,ys,n,max,iters);
+}
+
+void mandel_row( double xmin, double xmax, int width, int i0, int n, double y, int max, int *iters )
+{
+	double xs[MANDEL_CHUNK];
+	double ys[MANDEL_CHUNK];
+
+	for(int k=0;k<n;k+=MANDEL_CHUNK) {
+		int m = n-k < MANDEL_CHUNK ? n-k : MANDEL_CHUNK;
+		for(int c=0;c<m;c++) {
+			int i = i0+k+c;
+			xs[c] = xmin + i*(xmax-xmin)/width;
+			ys[c] = y;
+		}
+		mandel_kernels[mandel_accel](xs,ys,m,max,&iters[k]);
+	}
+}
+
+int mandel_tier( double pixel, double extent )
+{
+	pixel = fabs(pixel);
+	if(extent<pixel) extent = pixel;
+
+	if(pixel >= extent*MANDEL_TIER_ULPS*FLT_EPSILON) return MANDEL_FLOAT;
+	if(pixel >= extent*MANDEL_TIER_ULPS*DBL_EPSILON) return MANDEL_DOUBLE;
+	return MANDEL_DOUBLE_DOUBLE;
+}
+
+const char *mandel_tier_name( int tier )
+{
+	static const char *names[] = { "float", "double", "double-double" };
+	return names[tier];
+}
+
+void mandel_pixels( int tier, const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters )
+{
+	mandel_tier_kernels[tier][mandel_accel](g,is,js,n,max,iters);
+}
+
+mandel_formula_func mandel_formula_kernel( const struct mandel_formula *f )
+{
+	if(f->family<MANDEL_MULTIBROT || f->family>MANDEL_JULIA || f->power<0 || f->power>MANDEL_MAX_POWER) return 0;
+	return mandel_formula_kernels[f->family][f->power];
+}
+
+void mandel_points_resume( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters )
+{
+	mandel_resume_kernels[mandel_accel](xs,ys,n,max,zrs,zis,iters);
+}
+
+void mandel_row_resume( double xmin, double xmax, int width, int i0, int n, double y, int max, double *zrs, double *zis, int *iters )
+{
+	double xs[MANDEL_CHUNK];
+	double ys[MANDEL_CHUNK];
+
+	for(int k=0;k<n;k+=MANDEL_CHUNK) {
+		int m = n-k < MANDEL_CHUNK ? n-k : MANDEL_CHUNK;
+		for(int c=0;c<m;c++) {
+			int i = i0+k+c;
+			xs[c] = xmin + i*(xmax-xmin)/width;
+			ys[c] = y;
+		}
+		mandel_resume_kernels[mandel_accel](xs,ys,m,max,&zrs[k],&zis[k],&iters[k]);
+	}
+}
+
+void mandel_points_perturbed( const struct mandel_orbit *orbit, const double *dxs, const double *dys, int n, int max, int *iters )
+{
+	for(int i=0;i<n;i++) iters[i] = mandel_perturbed_point(orbit,dxs[i],dys[i],max);
+}
+
+void mandel_row_perturbed( const struct mandel_orbit *orbit, double xmin, double xmax, int width, int i0, int n, double y, int max, int *iters )
+{
+	for(int k=0;k<n;k++) {
+		int i = i0+k;
+		iters[k] = mandel_perturbed_point(orbit,xmin + i*(xmax-xmin)/width,y,max);
+	}
+}
@@ -0,0 +1,128 @@
+/*
+mandel.h - Mandelbrot escape time kernels shared by the fractal programs.
+The kernels iterate several points at once with AVX2 or AVX-512 when
+the CPU has them, and falls back to the scalar kernel otherwise.
+Every kernel produces exactly the same iteration counts as mandel_point,
+or as mandel_point_accelerated once accelerated mode is turned on.
+*/
+
+#ifndef MANDEL_H
+#define MANDEL_H
+
+/* Pick the fastest kernel this CPU supports. Setting MANDEL_KERNEL to scalar, avx2 or avx512 overrides the choice. */
+void mandel_init();
+
+/* Return the name of the kernel picked by mandel_init. */
+const char *mandel_kernel_name();
+
+/* Return the number of iterations at x+iy, up to a maximum of max. This is the reference every other kernel matches. */
+int mandel_point( double x, double y, int max );
+
+/* Like mandel_point, but skip the cardioid and the period 2 bulb, and stop as soon as the orbit is caught in a cycle. */
+int mandel_point_accelerated( double x, double y, int max );
+
+/* Turn accelerated mode on or off for mandel_row. Set this before any threads start computing. */
+void mandel_set_accelerated( int on );
+
+/* Return true if accelerated mode is on. */
+int mandel_accelerated();
+
+/* Compute the iterations at each of the n points xs[k]+i*ys[k]. */
+void mandel_points( const double *xs, const double *ys, int n, int max, int *iters );
+
+/* Compute pixels i0 to i0+n-1 of a row of the given width at height y, where pixel i is at x = xmin + i*(xmax-xmin)/width. */
+void mandel_row( double xmin, double xmax, int width, int i0, int n, double y, int max, int *iters );
+
+/*
+Carry on iterating n points from where an earlier call stopped.  On entry
+zrs, zis and iters hold each point's z and count, all zero for a fresh
+start.  On exit they hold where each point stopped, either escaped or at
+max, so a later call with a higher max picks up from there.  A NAN in zr
+marks a point known never to escape, which always comes back with max.
+*/
+void mandel_points_resume( const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters );
+
+/* mandel_points_resume for pixels i0 to i0+n-1 of a row, laid out as in mandel_row. */
+void mandel_row_resume( double xmin, double xmax, int width, int i0, int n, double y, int max, double *zrs, double *zis, int *iters );
+
+/* The families of formulas mandel_formula_kernel has kernels for. */
+#define MANDEL_MULTIBROT 0
+#define MANDEL_JULIA 1
+
+/* The highest power of z there are kernels for. */
+#define MANDEL_MAX_POWER 8
+
+/*
+A formula to draw instead of the Mandelbrot set.  A Multibrot set
+iterates z^power + c from z = 0, where c is the point, so power 2 is
+the Mandelbrot set again.  A Julia set iterates z^power + k from z at
+the point, with the same constant k = kr+i*ki for every point.
+*/
+struct mandel_formula {
+	int family;
+	int power;
+	double kr;
+	double ki;
+};
+
+/* Carry on n points with a formula, as mandel_points_resume does. A point whose count is zero starts afresh. */
+typedef void (*mandel_formula_func)( const struct mandel_formula *f, const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters );
+
+/*
+Return the kernel for a formula's family and power, or 0 if there is
+none.  Each kernel is built for one power, which it raises z to with a
+fixed chain of multiplies instead of a general complex power, so look
+it up once and call it for every batch of points.  Every instruction
+set gives the same counts, and Multibrot power 2 matches mandel_point.
+The kernels ignore accelerated mode.
+*/
+mandel_formula_func mandel_formula_kernel( const struct mandel_formula *f );
+
+/* The precision tiers for mandel_pixels, cheapest first. */
+#define MANDEL_FLOAT 0
+#define MANDEL_DOUBLE 1
+#define MANDEL_DOUBLE_DOUBLE 2
+
+/* A width x height grid of pixels over a region, where pixel i is at x = xmin + i*(xmax-xmin)/width, as in mandel_row. */
+struct mandel_grid {
+	double xmin;
+	double xmax;
+	double ymin;
+	double ymax;
+	int width;
+	int height;
+};
+
+/* Return the cheapest tier that can still tell apart pixels this far apart, at coordinates up to extent in size. */
+int mandel_tier( double pixel, double extent );
+
+/* Return the name of a tier. */
+const char *mandel_tier_name( int tier );
+
+/*
+Compute the iterations at the n pixels (is[k],js[k]) of the grid with
+the given tier.  Only the double tier matches mandel_point exactly.
+The double-double tier works out each coordinate to about 106 bits,
+so pixels stay apart long after xmin + i*(xmax-xmin)/width stops
+changing with i in a double.
+*/
+void mandel_pixels( int tier, const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters );
+
+/* A reference orbit for deep zooms: Z_0 = 0 up to Z_length, which escaped or was the last one asked for. */
+struct mandel_orbit {
+	int length;
+	double *zr;
+	double *zi;
+};
+
+/*
+Compute the iterations at each of the n points offset by dxs[k]+i*dys[k]
+from the orbit's reference point, by perturbation.  This ignores
+accelerated mode, and only matches mandel_point to within rounding.
+*/
+void mandel_points_perturbed( const struct mandel_orbit *orbit, const double *dxs, const double *dys, int n, int max, int *iters );
+
+/* mandel_points_perturbed for pixels i0 to i0+n-1 of a row of offsets, laid out as in mandel_row. */
+void mandel_row_perturbed( const struct mandel_orbit *orbit, double xmin, double xmax, int width, int i0, int n, double y, int max, int *iters );
+
+#endif
@@ -0,0 +1,362 @@
+/*
+mandel_template.h - The escape time kernel for one precision tier and
+one vector width.  mandel.c includes this once for each combination,
+after defining:
+
+  MANDEL_T_NAME(x)  x with this instance's suffix pasted on
+  MANDEL_T_KIND     MANDEL_FLOAT, MANDEL_DOUBLE or MANDEL_DOUBLE_DOUBLE
+  MANDEL_T_BYTES    how many bytes wide the vectors are
+  MANDEL_T_TARGET   the target attribute for the instruction set, if any
+
+The vectors are GCC vector extensions, so the same source becomes SSE,
+AVX2 or AVX-512 code depending on the width and the target.  The double
+instance does the same operations in the same order as mandel_point.
+
+The double instance also has the formula kernels, one for each family
+and power, and a table of them for mandel_formula_kernel.
+
+A double-double number is an unevaluated sum hi+lo of two doubles,
+which carries about 106 bits.  The products are split Dekker's way
+rather than with fused multiply-adds, since -std=c99 never fuses them.
+*/
+
+#define MT(x) MANDEL_T_NAME(x)
+
+#if MANDEL_T_KIND==MANDEL_FLOAT
+typedef float MT(vreal) __attribute__((vector_size(MANDEL_T_BYTES)));
+typedef int MT(vmask) __attribute__((vector_size(MANDEL_T_BYTES)));
+#define MT_LANES (MANDEL_T_BYTES/4)
+#else
+typedef double MT(vreal) __attribute__((vector_size(MANDEL_T_BYTES)));
+typedef long long MT(vmask) __attribute__((vector_size(MANDEL_T_BYTES)));
+#define MT_LANES (MANDEL_T_BYTES/8)
+#endif
+
+/* Return true if any lane is set. */
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline int MT(any)( MT(vmask) m )
+{
+	for(int l=1;l<MT_LANES;l++) m[0] |= m[l];
+	return m[0]!=0;
+}
+
+#if MANDEL_T_KIND==MANDEL_DOUBLE_DOUBLE
+
+typedef struct {
+	MT(vreal) hi;
+	MT(vreal) lo;
+} MT(num);
+
+/* hi+lo = a*b exactly, splitting each factor into two 26 bit halves. */
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(two_prod)( MT(vreal) a, MT(vreal) b )
+{
+	MT(vreal) t = a*134217729.0;
+	MT(vreal) ah = t-(t-a);
+	MT(vreal) al = a-ah;
+	t = b*134217729.0;
+	MT(vreal) bh = t-(t-b);
+	MT(vreal) bl = b-bh;
+
+	MT(num) r;
+	r.hi = a*b;
+	r.lo = ((ah*bh-r.hi) + ah*bl + al*bh) + al*bl;
+	return r;
+}
+
+/* Renormalize hi+lo, given that |hi| >= |lo|. */
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(quick_sum)( MT(vreal) a, MT(vreal) b )
+{
+	MT(num) r;
+	r.hi = a+b;
+	r.lo = b-(r.hi-a);
+	return r;
+}
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(add)( MT(num) a, MT(num) b )
+{
+	MT(vreal) s = a.hi+b.hi;
+	MT(vreal) v = s-a.hi;
+	MT(vreal) e = (a.hi-(s-v)) + (b.hi-v);
+	return MT(quick_sum)(s,e + a.lo + b.lo);
+}
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(sub)( MT(num) a, MT(num) b )
+{
+	b.hi = -b.hi;
+	b.lo = -b.lo;
+	return MT(add)(a,b);
+}
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(mul)( MT(num) a, MT(num) b )
+{
+	MT(num) p = MT(two_prod)(a.hi,b.hi);
+	return MT(quick_sum)(p.hi,p.lo + a.hi*b.lo + a.lo*b.hi);
+}
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(num) MT(twice)( MT(num) a )
+{
+	a.hi = a.hi*2;
+	a.lo = a.lo*2;
+	return a;
+}
+
+#define MT_HI(a) ((a).hi)
+#define MT_EQUAL(a,b) (((a).hi==(b).hi) & ((a).lo==(b).lo))
+#define MT_ADD(a,b) MT(add)(a,b)
+#define MT_SUB(a,b) MT(sub)(a,b)
+#define MT_MUL(a,b) MT(mul)(a,b)
+#define MT_TWICE(a) MT(twice)(a)
+
+#else
+
+typedef MT(vreal) MT(num);
+
+#define MT_HI(a) (a)
+#define MT_EQUAL(a,b) ((a)==(b))
+#define MT_ADD(a,b) ((a)+(b))
+#define MT_SUB(a,b) ((a)-(b))
+#define MT_MUL(a,b) ((a)*(b))
+#define MT_TWICE(a) (2*(a))
+#endif
+
+/* Compute the pixels (is[k],js[k]) of the grid, a vector of them at a time. */
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline void MT(mandel_pixels_body)( const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters, const int accel )
+{
+	for(int k=0;k<n;k+=MT_LANES) {
+		MT(num) cr, ci;
+
+		/* Spare lanes in the last group repeat the final pixel. */
+		for(int l=0;l<MT_LANES;l++) {
+			int p = k+l<n ? k+l : n-1;
+#if MANDEL_T_KIND==MANDEL_DOUBLE_DOUBLE
+			double hi, lo;
+			mandel_dd_coordinate(g->xmin,g->xmax,g->width,is[p],&hi,&lo);
+			cr.hi[l] = hi;
+			cr.lo[l] = lo;
+			mandel_dd_coordinate(g->ymin,g->ymax,g->height,js[p],&hi,&lo);
+			ci.hi[l] = hi;
+			ci.lo[l] = lo;
+#else
+			cr[l] = g->xmin + is[p]*(g->xmax-g->xmin)/g->width;
+			ci[l] = g->ymin + js[p]*(g->ymax-g->ymin)/g->height;
+#endif
+		}
+
+		MT(num) zr = { 0 };
+		MT(num) zi = { 0 };
+		MT(num) sr = { 0 };
+		MT(num) si = { 0 };
+		MT(vmask) count = { 0 };
+		MT(vmask) active = count-1;
+
+		if(accel) {
+			/* The cardioid and the bulb, tested on the leading part alone. */
+			MT(vreal) x = MT_HI(cr);
+			MT(vreal) y2 = MT_HI(ci)*MT_HI(ci);
+			MT(vreal) xq = x-0.25f;
+			MT(vreal) q = xq*xq + y2;
+			MT(vmask) inside = (q*(q+xq) <= 0.25f*y2) | ((x+1)*(x+1) + y2 <= 0.0625f);
+			count = inside & max;
+			active = ~inside;
+		}
+
+		int period = 0;
+		int limit = MANDEL_CYCLE_START;
+
+		for(int it=0;it<max;it++) {
+			MT(num) zr2 = MT_MUL(zr,zr);
+			MT(num) zi2 = MT_MUL(zi,zi);
+
+			active &= MT_HI(zr2) + MT_HI(zi2) < 16;
+			count -= active;
+
+			/* Escaped lanes stay inactive however their z runs off, so checking now and then is enough. */
+			if((it&15)==15 && !MT(any)(active)) break;
+
+			MT(num) t = MT_ADD(MT_SUB(zr2,zi2),cr);
+			zi = MT_ADD(MT_MUL(MT_TWICE(zr),zi),ci);
+			zr = t;
+
+			if(accel) {
+				MT(vmask) cycle = active & MT_EQUAL(zr,sr) & MT_EQUAL(zi,si);
+				count = (cycle & max) | (~cycle & count);
+				active &= ~cycle;
+
+				if(++period==limit) {
+					period = 0;
+					limit *= 2;
+					sr = zr;
+					si = zi;
+				}
+			}
+		}
+
+		for(int l=0;l<MT_LANES && k+l<n;l++) iters[k+l] = (int)count[l];
+	}
+}
+
+MANDEL_T_TARGET
+static void MT(mandel_pixels)( const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters )
+{
+	MT(mandel_pixels_body)(g,is,js,n,max,iters,0);
+}
+
+MANDEL_T_TARGET
+static void MT(mandel_pixels_accel)( const struct mandel_grid *g, const int *is, const int *js, int n, int max, int *iters )
+{
+	MT(mandel_pixels_body)(g,is,js,n,max,iters,1);
+}
+
+#if MANDEL_T_KIND==MANDEL_DOUBLE
+
+typedef struct {
+	MT(vreal) re;
+	MT(vreal) im;
+} MT(cplx);
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(cplx) MT(cmul)( MT(cplx) a, MT(cplx) b )
+{
+	MT(cplx) r;
+	r.re = a.re*b.re - a.im*b.im;
+	r.im = a.re*b.im + a.im*b.re;
+	return r;
+}
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline MT(cplx) MT(csquare)( MT(cplx) a )
+{
+	MT(cplx) r;
+	r.re = a.re*a.re - a.im*a.im;
+	r.im = 2*a.re*a.im;
+	return r;
+}
+
+/* Lanes of a where the mask is set, and of b elsewhere. */
+#define MT_SELECT(m,a,b) ((MT(vreal))(((MT(vmask))(a) & (m)) | ((MT(vmask))(b) & ~(m))))
+
+/*
+Carry on the points with z^power plus the point, or plus the Julia
+constant.  The lanes may start at different counts, so each one only
+takes a new z while it is still going, and keeps the one it stopped at.
+Julia and power are always constants, so each wrapper below gets its
+own copy with only the multiplies for its power.  z^2 is worked out the
+way mandel_point does it, from the squares the bailout test needs.
+*/
+
+MANDEL_T_TARGET __attribute__((always_inline))
+static inline void MT(mandel_formula_body)( const struct mandel_formula *f, const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters, const int julia, const int power )
+{
+	for(int k=0;k<n;k+=MT_LANES) {
+		MT(vreal) cr, ci;
+		MT(cplx) z;
+		MT(vmask) count;
+
+		/* Spare lanes in the last group repeat the final point. */
+		for(int l=0;l<MT_LANES;l++) {
+			int p = k+l<n ? k+l : n-1;
+			count[l] = iters[p];
+			z.re[l] = zrs[p];
+			z.im[l] = zis[p];
+			if(julia) {
+				if(!iters[p]) {
+					z.re[l] = xs[p];
+					z.im[l] = ys[p];
+				}
+				cr[l] = f->kr;
+				ci[l] = f->ki;
+			} else {
+				cr[l] = xs[p];
+				ci[l] = ys[p];
+			}
+		}
+
+		MT(vmask) active = count < max;
+
+		while(MT(any)(active)) {
+			MT(vreal) zr2 = z.re*z.re;
+			MT(vreal) zi2 = z.im*z.im;
+
+			active &= zr2 + zi2 < 16;
+
+			MT(cplx) z2, p;
+			z2.re = zr2 - zi2;
+			z2.im = 2*z.re*z.im;
+
+			switch(power) {
+			case 2: p = z2; break;
+			case 3: p = MT(cmul)(z2,z); break;
+			case 4: p = MT(csquare)(z2); break;
+			case 5: p = MT(cmul)(MT(csquare)(z2),z); break;
+			case 6: p = MT(csquare)(MT(cmul)(z2,z)); break;
+			case 7: p = MT(cmul)(MT(csquare)(MT(cmul)(z2,z)),z); break;
+			default: p = MT(csquare)(MT(csquare)(z2)); break;
+			}
+
+			z.re = MT_SELECT(active,p.re + cr,z.re);
+			z.im = MT_SELECT(active,p.im + ci,z.im);
+			count -= active;
+			active &= count < max;
+		}
+
+		for(int l=0;l<MT_LANES && k+l<n;l++) {
+			zrs[k+l] = z.re[l];
+			zis[k+l] = z.im[l];
+			iters[k+l] = (int)count[l];
+		}
+	}
+}
+
+#define MT_FORMULA(family,julia,power) \
+MANDEL_T_TARGET \
+static void MT(mandel_##family##power)( const struct mandel_formula *f, const double *xs, const double *ys, int n, int max, double *zrs, double *zis, int *iters ) \
+{ \
+	MT(mandel_formula_body)(f,xs,ys,n,max,zrs,zis,iters,julia,power); \
+}
+
+MT_FORMULA(multibrot,0,2)
+MT_FORMULA(multibrot,0,3)
+MT_FORMULA(multibrot,0,4)
+MT_FORMULA(multibrot,0,5)
+MT_FORMULA(multibrot,0,6)
+MT_FORMULA(multibrot,0,7)
+MT_FORMULA(multibrot,0,8)
+MT_FORMULA(julia,1,2)
+MT_FORMULA(julia,1,3)
+MT_FORMULA(julia,1,4)
+MT_FORMULA(julia,1,5)
+MT_FORMULA(julia,1,6)
+MT_FORMULA(julia,1,7)
+MT_FORMULA(julia,1,8)
+
+/* Indexed by family and then power, with no kernels for powers below 2. */
+static const mandel_formula_func MT(mandel_formulas)[2][MANDEL_MAX_POWER+1] = {
+	{ 0, 0, MT(mandel_multibrot2), MT(mandel_multibrot3), MT(mandel_multibrot4), MT(mandel_multibrot5),
+		MT(mandel_multibrot6), MT(mandel_multibrot7), MT(mandel_multibrot8) },
+	{ 0, 0, MT(mandel_julia2), MT(mandel_julia3), MT(mandel_julia4), MT(mandel_julia5),
+		MT(mandel_julia6), MT(mandel_julia7), MT(mandel_julia8) },
+};
+
+#undef MT_SELECT
+#undef MT_FORMULA
+#endif
+
+#undef MT_LANES
+#undef MT_HI
+#undef MT_EQUAL
+#undef MT_ADD
+#undef MT_SUB
+#undef MT_MUL
+#undef MT_TWICE
+#undef MT
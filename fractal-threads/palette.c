@@ -0,0 +1,90 @@
+/*
+palette.c - Colors for iteration counts, worked out ahead of time.
+
+The fractional count is the usual n + 1 - log2(log2 |z|), less the
+whole n, with |z| taken where the orbit first reached |z|^2 >= 16.
+It is 0 when |z| is just 4 and falls towards -1 as |z| grows, which
+joins up with the next whole count.  Only |z|^2 up to 16^2 or so can
+come out of one step from inside the bailout, so a table over that
+range is enough.
+*/
+
+#include "palette.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+/* The gradient's fixed colors, at positions from 0 to 1 around the cycle. */
+static const struct {
+	double at;
+	int r, g, b;
+} palette_stops[] = {
+	{ 0.0,    0,   7, 100 },
+	{ 0.16,  32, 107, 203 },
+	{ 0.42, 237, 255, 255 },
+	{ 0.64, 255, 170,   0 },
+	{ 0.86,   0,   2,   0 },
+	{ 1.0,    0,   7, 100 },
+};
+
+void palette_init( struct palette *p )
+{
+	p->scheme = PALETTE_GRAY;
+	p->maxiter = -1;
+	p->colors = 0;
+	p->capacity = 0;
+
+	int nstops = sizeof(palette_stops)/sizeof(palette_stops[0]);
+
+	for(int k=0;k<PALETTE_RAMP_SIZE;k++) {
+		double t = (double)k/PALETTE_RAMP_SIZE;
+		int s = 0;
+		while(s<nstops-2 && palette_stops[s+1].at<=t) s++;
+
+		double f = (t-palette_stops[s].at)/(palette_stops[s+1].at-palette_stops[s].at);
+		int r = palette_stops[s].r + f*(palette_stops[s+1].r-palette_stops[s].r);
+		int g = palette_stops[s].g + f*(palette_stops[s+1].g-palette_stops[s].g);
+		int b = palette_stops[s].b + f*(palette_stops[s+1].b-palette_stops[s].b);
+		p->ramp[k] = (r<<16) | (g<<8) | b;
+	}
+
+	for(int k=0;k<PALETTE_FRACTION_SIZE;k++) {
+		/* The middle of each slot, so rounding goes both ways. */
+		double r2 = PALETTE_BAILOUT + (k+0.5)/PALETTE_FRACTION_SCALE;
+		double fraction = 1 - log2(log2(r2)/2);
+		p->offset[k] = (int)lround(fraction*PALETTE_STEPS);
+	}
+}
+
+void palette_free( struct palette *p )
+{
+	free(p->colors);
+	p->colors = 0;
+	p->capacity = 0;
+	p->maxiter = -1;
+}
+
+int palette_update( struct palette *p, int scheme, int maxiter )
+{
+	if(scheme==p->scheme && maxiter==p->maxiter) return 1;
+
+	if(maxiter+1>p->capacity) {
+		unsigned int *colors = realloc(p->colors,(maxiter+1)*sizeof(unsigned int));
+		if(!colors) return 0;
+		p->colors = colors;
+		p->capacity = maxiter+1;
+	}
+
+	for(int i=0;i<=maxiter;i++) {
+		if(scheme==PALETTE_GRADIENT) {
+			p->colors[i] = i==maxiter ? 0 : p->ramp[(i*PALETTE_STEPS) & (PALETTE_RAMP_SIZE-1)];
+		} else {
+			int gray = maxiter>0 ? 255*i/maxiter : 0;
+			p->colors[i] = (gray<<16) | (gray<<8) | gray;
+		}
+	}
+
+	p->scheme = scheme;
+	p->maxiter = maxiter;
+	return 1;
+}
@@ -0,0 +1,75 @@
+/*
+palette.h - Colors for iteration counts, worked out ahead of time.
+A palette holds the 0xRRGGBB color of every count from 0 to maxiter,
+rebuilt only when maxiter or the scheme changes, so coloring a pixel
+is one array index.  The gradient scheme also colors escaped pixels by
+their fractional count, from where the orbit ended up, which smooths
+away the bands between whole counts.  That takes two small tables: one
+for the fraction and one for the gradient itself.
+*/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+/* The original shades of gray, white inside the set. */
+#define PALETTE_GRAY 0
+
+/* A cycling blue, white and orange gradient, black inside the set. */
+#define PALETTE_GRADIENT 1
+
+/* Entries in the gradient, and how many of them one iteration moves along. */
+#define PALETTE_RAMP_SIZE 1024
+#define PALETTE_STEPS 16
+
+/* The kernels stop at |z|^2 >= 16, so that is where the fraction table starts. */
+#define PALETTE_BAILOUT 16.0
+
+/* Entries in the fraction table, each covering 1/PALETTE_FRACTION_SCALE of |z|^2. */
+#define PALETTE_FRACTION_SIZE 1024
+#define PALETTE_FRACTION_SCALE 2.0
+
+struct palette {
+	int scheme;
+	int maxiter;
+
+	/* The color of every count from 0 to maxiter. */
+	unsigned int *colors;
+	int capacity;
+
+	/* The gradient, and the fraction of an iteration (in steps along it) to add for each |z|^2 at escape. */
+	unsigned int ramp[PALETTE_RAMP_SIZE];
+	int offset[PALETTE_FRACTION_SIZE];
+};
+
+/* Start an empty palette. The first palette_update fills it in. */
+void palette_init( struct palette *p );
+
+/* Free the colors. */
+void palette_free( struct palette *p );
+
+/* Make the palette match the scheme and maxiter, doing nothing if it already does. Return 0 if out of memory. */
+int palette_update( struct palette *p, int scheme, int maxiter );
+
+/* Return the color of a count from 0 to maxiter. */
+static inline unsigned int palette_color( const struct palette *p, int iter )
+{
+	return p->colors[iter];
+}
+
+/*
+Return the color of a count with the fraction given by |z|^2 where the
+orbit escaped.  This only differs from palette_color in the gradient
+scheme, and any |z|^2 that could not come from an escape is taken to
+have no fraction.
+*/
+static inline unsigned int palette_smooth( const struct palette *p, int iter, double r2 )
+{
+	if(p->scheme!=PALETTE_GRADIENT || iter>=p->maxiter || !(r2>=PALETTE_BAILOUT)) return p->colors[iter];
+
+	double k = (r2-PALETTE_BAILOUT)*PALETTE_FRACTION_SCALE;
+	int i = k<PALETTE_FRACTION_SIZE-1 ? (int)k : PALETTE_FRACTION_SIZE-1;
+
+	return p->ramp[(iter*PALETTE_STEPS + p->offset[i] + PALETTE_RAMP_SIZE) & (PALETTE_RAMP_SIZE-1)];
+}
+
+#endif
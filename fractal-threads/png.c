@@ -0,0 +1,96 @@
+/*
+png.c - Encoding colors as a PNG image in memory.
+
+A PNG file is an eight byte signature followed by chunks, each its
+length, its type, its data and a CRC of the type and data.  This writes
+the header chunk, one data chunk holding every row compressed together
+by zlib, and the end chunk.  Each row starts with its filter type; the
+Sub filter stores each byte minus the one three bytes before it, so a
+run of one color becomes a run of zeros.
+*/
+
+#include "png.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+static void put_u32( unsigned char *p, unsigned long v )
+{
+	p[0] = v>>24;
+	p[1] = v>>16;
+	p[2] = v>>8;
+	p[3] = v;
+}
+
+/* Write a chunk whose data is already in place after its length and type. Return where the next one goes. */
+
+static unsigned char *png_chunk( unsigned char *p, const char *type, size_t length )
+{
+	put_u32(p,length);
+	memcpy(p+4,type,4);
+	put_u32(p+8+length,crc32(crc32(0,Z_NULL,0),p+4,length+4));
+	return p+12+length;
+}
+
+int png_encode( const unsigned int *pixels, int stride, int w, int h, unsigned char **data, size_t *size )
+{
+	static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	size_t row = 1+(size_t)w*3;
+	size_t raw_size = row*h;
+
+	unsigned char *raw = malloc(raw_size);
+	if(!raw) return 0;
+
+	for(int j=0;j<h;j++) {
+		unsigned char *out = &raw[j*row];
+		const unsigned int *in = &pixels[(size_t)j*stride];
+		unsigned int left = 0;
+
+		*out++ = 1;
+		for(int i=0;i<w;i++) {
+			unsigned int c = in[i];
+			*out++ = (c>>16) - (left>>16);
+			*out++ = (c>>8) - (left>>8);
+			*out++ = c - left;
+			left = c;
+		}
+	}
+
+	uLongf packed = compressBound(raw_size);
+	unsigned char *file = malloc(sizeof(signature) + 12+13 + 12+packed + 12);
+	if(!file) {
+		free(raw);
+		errno = ENOMEM;
+		return 0;
+	}
+
+	unsigned char *p = file;
+	memcpy(p,signature,sizeof(signature));
+	p += sizeof(signature);
+
+	/* Size, 8 bits per channel, truecolor, and the standard compression, filters and no interlacing. */
+	put_u32(p+8,w);
+	put_u32(p+12,h);
+	p[16] = 8;
+	p[17] = 2;
+	p[18] = 0;
+	p[19] = 0;
+	p[20] = 0;
+	p = png_chunk(p,"IHDR",13);
+
+	int ok = compress2(p+8,&packed,raw,raw_size,Z_DEFAULT_COMPRESSION)==Z_OK;
+	free(raw);
+	if(!ok) {
+		free(file);
+		errno = ENOMEM;
+		return 0;
+	}
+	p = png_chunk(p,"IDAT",packed);
+	p = png_chunk(p,"IEND",0);
+
+	*data = file;
+	*size = p-file;
+	return 1;
+}
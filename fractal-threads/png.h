@@ -0,0 +1,20 @@
+/*
+png.h - Encoding colors as a PNG image in memory.
+Just enough of PNG for the renderer's pixels: 8 bit RGB, compressed
+with zlib, each row filtered by its difference from the pixel to its
+left, which suits the long runs of one color in a fractal.
+*/
+
+#ifndef PNG_H
+#define PNG_H
+
+#include <stddef.h>
+
+/*
+Encode a w x h image of 0xRRGGBB colors, with rows stride apart, as a
+PNG file.  Put a malloc'd copy of the file in *data and its size in
+*size.  Return 0 on failure.
+*/
+int png_encode( const unsigned int *pixels, int stride, int w, int h, unsigned char **data, size_t *size );
+
+#endif
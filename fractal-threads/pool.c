@@ -0,0 +1,177 @@
+/*
+pool.c - A pool of threads that lives for the whole program.
+
+Creating and joining threads for every frame costs more than a small
+frame takes to compute.  Here the threads are created once, and each
+pool_run bumps a generation number and broadcasts to wake them.  A
+thread runs the job once per generation, and the last one to finish
+signals the caller.
+
+Pinning is optional.  It stops the scheduler from moving threads
+between cores mid-frame, and it keeps each thread on one NUMA node, so
+memory it touches first stays local to it.
+*/
+
+#define _GNU_SOURCE
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+struct pool_thread {
+	struct pool *p;
+	int id;
+	int started;
+	pthread_t thread;
+};
+
+static void *pool_main( void *arg )
+{
+	struct pool_thread *t = arg;
+	struct pool *p = t->p;
+	long seen = 0;
+
+	pthread_mutex_lock(&p->lock);
+
+	while(1) {
+		while(!p->quit && p->generation==seen) {
+			pthread_cond_wait(&p->start,&p->lock);
+		}
+		if(p->quit) break;
+
+		seen = p->generation;
+
+		/* Threads beyond the active count sit this generation out. */
+		if(t->id<p->nactive) {
+			pool_func func = p->func;
+			void *arg = p->arg;
+
+			pthread_mutex_unlock(&p->lock);
+			func(t->id,arg);
+			pthread_mutex_lock(&p->lock);
+
+			if(--p->running==0) pthread_cond_signal(&p->done);
+		}
+	}
+
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+struct pool *pool_create( int nthreads )
+{
+	if(nthreads<1) nthreads = 1;
+
+	struct pool *p = calloc(1,sizeof(*p));
+	if(!p) return 0;
+
+	p->threads = calloc(nthreads,sizeof(struct pool_thread));
+	if(!p->threads) {
+		free(p);
+		return 0;
+	}
+
+	pthread_mutex_init(&p->lock,NULL);
+	pthread_cond_init(&p->start,NULL);
+	pthread_cond_init(&p->done,NULL);
+	p->nthreads = nthreads;
+
+	/* Slot 0 is the caller of pool_run, so only the others get a thread. */
+	for(int i=1;i<nthreads;i++) {
+		struct pool_thread *t = &p->threads[i];
+		t->p = p;
+		t->id = i;
+		if(pthread_create(&t->thread,NULL,pool_main,t)) {
+			pool_delete(p);
+			return 0;
+		}
+		t->started = 1;
+	}
+
+	return p;
+}
+
+void pool_run( struct pool *p, int nactive, pool_func func, void *arg )
+{
+	if(nactive<1) nactive = 1;
+	if(nactive>p->nthreads) nactive = p->nthreads;
+
+	pthread_mutex_lock(&p->lock);
+	p->func = func;
+	p->arg = arg;
+	p->nactive = nactive;
+	p->running = nactive-1;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	func(0,arg);
+
+	pthread_mutex_lock(&p->lock);
+	while(p->running>0) {
+		pthread_cond_wait(&p->done,&p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_delete( struct pool *p )
+{
+	if(!p) return;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for(int i=1;i<p->nthreads;i++) {
+		if(p->threads[i].started) pthread_join(p->threads[i].thread,NULL);
+	}
+
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->start);
+	pthread_mutex_destroy(&p->lock);
+	free(p->threads);
+	free(p);
+}
+
+int pool_cpus()
+{
+	cpu_set_t set;
+
+	/* The affinity mask follows taskset and container limits, which the CPU count does not. */
+	if(sched_getaffinity(0,sizeof(set),&set)==0) return CPU_COUNT(&set);
+
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n>0 ? n : 1;
+}
+
+int pool_pin( struct pool *p )
+{
+	cpu_set_t allowed;
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0;
+
+	if(sched_getaffinity(0,sizeof(allowed),&allowed)) return 0;
+	for(int c=0;c<CPU_SETSIZE;c++) {
+		if(CPU_ISSET(c,&allowed)) cpus[ncpus++] = c;
+	}
+	if(ncpus==0) return 0;
+
+	for(int i=0;i<p->nthreads;i++) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpus[i%ncpus],&set);
+
+		pthread_t thread = i==0 ? pthread_self() : p->threads[i].thread;
+		int err = pthread_setaffinity_np(thread,sizeof(set),&set);
+		if(err) {
+			errno = err;
+			return 0;
+		}
+	}
+
+	return 1;
+}
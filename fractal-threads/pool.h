@@ -0,0 +1,49 @@
+/*
+pool.h - A pool of threads that lives for the whole program.
+The threads sleep on a condition variable between frames, and each
+call to pool_run wakes them up to run one function on new arguments.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+/* The function every thread runs, with the thread's id from 0 to nactive-1. */
+typedef void (*pool_func)( int id, void *arg );
+
+struct pool_thread;
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	int nthreads;
+	struct pool_thread *threads;
+
+	/* The job for the current generation. */
+	pool_func func;
+	void *arg;
+	int nactive;
+	long generation;
+	int running;
+	int quit;
+};
+
+/* Start a pool that can run up to nthreads ways at once. The caller counts as one of them. Return 0 on failure. */
+struct pool *pool_create( int nthreads );
+
+/* Run func on nactive threads at once and wait for them all to return. The caller runs id 0 itself. */
+void pool_run( struct pool *p, int nactive, pool_func func, void *arg );
+
+/* Stop and join every thread and free the pool. */
+void pool_delete( struct pool *p );
+
+/* Return how many CPUs this process may run on, which is the natural thread count. */
+int pool_cpus();
+
+/* Pin thread id to the id-th CPU this process may run on, wrapping around, with the caller as id 0. Return 0 on failure. */
+int pool_pin( struct pool *p );
+
+#endif
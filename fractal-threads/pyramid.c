@@ -0,0 +1,258 @@
+/*
+pyramid.c - A tiled image on disk, far bigger than memory, with every
+coarser level down to a single tile.
+
+The file is a page for the header, then the done flags of every level,
+padded out to a page, then the tiles of level 0 row by row, then those
+of level 1, and so on.  Every tile takes a full PYRAMID_TILE square,
+even on the right and bottom edges, so each one starts on a page and
+can be flushed and dropped by itself.  The file is created sparse, so
+tiles not yet drawn take no disk space.
+
+A tile's flag is only set after its pixels have been flushed, so a
+flag that made it to disk always means a complete tile.  A flag lost
+in a crash just means the tile is drawn again.
+*/
+
+#define _GNU_SOURCE
+
+#include "pyramid.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PYRAMID_MAGIC "FPYR"
+#define PYRAMID_VERSION 1
+#define PYRAMID_PAGE 4096
+#define PYRAMID_TILE_BYTES ((size_t)PYRAMID_TILE*PYRAMID_TILE*3)
+
+static size_t round_page( size_t n )
+{
+	return (n+PYRAMID_PAGE-1)/PYRAMID_PAGE*PYRAMID_PAGE;
+}
+
+/* Work out the levels and where everything goes. Return the size of the file. */
+
+static size_t pyramid_layout( struct pyramid_header *h )
+{
+	size_t offset = round_page(sizeof(*h));
+	int w = h->width;
+	int ht = h->height;
+
+	for(int l=0;l<PYRAMID_MAX_LEVELS;l++) {
+		struct pyramid_level *level = &h->level[l];
+		level->width = w;
+		level->height = ht;
+		level->tiles_x = (w+PYRAMID_TILE-1)/PYRAMID_TILE;
+		level->tiles_y = (ht+PYRAMID_TILE-1)/PYRAMID_TILE;
+		level->done = offset;
+		offset += (size_t)level->tiles_x*level->tiles_y;
+		h->levels = l+1;
+
+		if(level->tiles_x==1 && level->tiles_y==1) break;
+		w = (w+1)/2;
+		ht = (ht+1)/2;
+	}
+
+	offset = round_page(offset);
+	for(int l=0;l<h->levels;l++) {
+		struct pyramid_level *level = &h->level[l];
+		level->data = offset;
+		offset += (size_t)level->tiles_x*level->tiles_y*PYRAMID_TILE_BYTES;
+	}
+
+	return offset;
+}
+
+int pyramid_levels( int width, int height )
+{
+	struct pyramid_header h;
+	h.width = width;
+	h.height = height;
+	pyramid_layout(&h);
+	return h.levels;
+}
+
+struct pyramid *pyramid_open( const char *path, int width, int height, const double view[4], int maxiter, int mode )
+{
+	struct pyramid_header h;
+	struct stat info;
+
+	/* Zeroed first, so the padding compares equal too. */
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,PYRAMID_MAGIC,4);
+	h.version = PYRAMID_VERSION;
+	h.width = width;
+	h.height = height;
+	memcpy(h.view,view,sizeof(h.view));
+	h.maxiter = maxiter;
+	h.mode = mode;
+	size_t size = pyramid_layout(&h);
+
+	struct pyramid *p = calloc(1,sizeof(*p));
+	if(!p) return 0;
+
+	p->fd = open(path,O_RDWR|O_CREAT,0644);
+	if(p->fd<0 || fstat(p->fd,&info)<0) goto fail;
+
+	if(info.st_size==0) {
+		if(ftruncate(p->fd,size)<0 || pwrite(p->fd,&h,sizeof(h),0)!=sizeof(h)) goto fail;
+	} else {
+		struct pyramid_header old;
+		if((size_t)info.st_size!=size || pread(p->fd,&old,sizeof(old),0)!=sizeof(old) || memcmp(&old,&h,sizeof(h))) {
+			errno = EINVAL;
+			goto fail;
+		}
+	}
+
+	p->size = size;
+	p->map = mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,p->fd,0);
+	if(p->map==MAP_FAILED) {
+		p->map = 0;
+		goto fail;
+	}
+	p->header = (struct pyramid_header *)p->map;
+
+	return p;
+
+fail:
+	if(p->fd>=0) {
+		int saved = errno;
+		close(p->fd);
+		errno = saved;
+	}
+	free(p);
+	return 0;
+}
+
+void pyramid_close( struct pyramid *p )
+{
+	if(!p) return;
+
+	if(p->map) {
+		msync(p->map,p->header->level[0].data,MS_SYNC);
+		munmap(p->map,p->size);
+	}
+	close(p->fd);
+	free(p);
+}
+
+unsigned char *pyramid_tile( struct pyramid *p, int level, int tx, int ty )
+{
+	const struct pyramid_level *l = &p->header->level[level];
+	return p->map + l->data + ((size_t)ty*l->tiles_x+tx)*PYRAMID_TILE_BYTES;
+}
+
+static unsigned char *pyramid_flag( struct pyramid *p, int level, int tx, int ty )
+{
+	const struct pyramid_level *l = &p->header->level[level];
+	return p->map + l->done + (size_t)ty*l->tiles_x+tx;
+}
+
+int pyramid_done( struct pyramid *p, int level, int tx, int ty )
+{
+	return *pyramid_flag(p,level,tx,ty);
+}
+
+int pyramid_finish( struct pyramid *p, int level, int tx, int ty )
+{
+	unsigned char *tile = pyramid_tile(p,level,tx,ty);
+
+	if(msync(tile,PYRAMID_TILE_BYTES,MS_SYNC)<0) return 0;
+	madvise(tile,PYRAMID_TILE_BYTES,MADV_DONTNEED);
+
+	*pyramid_flag(p,level,tx,ty) = 1;
+	return 1;
+}
+
+void pyramid_downsample( struct pyramid *p, int level, int tx, int ty )
+{
+	const struct pyramid_level *up = &p->header->level[level];
+	const struct pyramid_level *down = &p->header->level[level-1];
+	unsigned char *tile = pyramid_tile(p,level,tx,ty);
+	unsigned char *children[2][2];
+
+	/* The up to four tiles below, missing past the right or bottom edge. */
+	for(int b=0;b<2;b++) {
+		for(int a=0;a<2;a++) {
+			int cx = 2*tx+a;
+			int cy = 2*ty+b;
+			children[b][a] = cx<down->tiles_x && cy<down->tiles_y ? pyramid_tile(p,level-1,cx,cy) : 0;
+		}
+	}
+
+	for(int j=0;j<PYRAMID_TILE;j++) {
+		int y = ty*PYRAMID_TILE+j;
+
+		for(int i=0;i<PYRAMID_TILE;i++) {
+			int x = tx*PYRAMID_TILE+i;
+			unsigned char *out = &tile[(j*PYRAMID_TILE+i)*3];
+			int sum[3] = { 0, 0, 0 };
+			int count = 0;
+
+			if(x>=up->width || y>=up->height) {
+				memset(out,0,3);
+				continue;
+			}
+
+			/* Average whichever of the 2x2 block below lies inside that level. */
+			for(int b=0;b<2;b++) {
+				for(int a=0;a<2;a++) {
+					int ci = 2*i+a;
+					int cj = 2*j+b;
+					if(2*x+a>=down->width || 2*y+b>=down->height) continue;
+
+					unsigned char *child = children[cj/PYRAMID_TILE][ci/PYRAMID_TILE];
+					unsigned char *in = &child[((cj%PYRAMID_TILE)*PYRAMID_TILE+ci%PYRAMID_TILE)*3];
+					sum[0] += in[0];
+					sum[1] += in[1];
+					sum[2] += in[2];
+					count++;
+				}
+			}
+
+			for(int c=0;c<3;c++) out[c] = (sum[c]+count/2)/count;
+		}
+	}
+
+	/* Each tile below is only read for this one, so it can leave memory now. */
+	for(int b=0;b<2;b++) {
+		for(int a=0;a<2;a++) {
+			if(children[b][a]) madvise(children[b][a],PYRAMID_TILE_BYTES,MADV_DONTNEED);
+		}
+	}
+}
+
+int pyramid_write_ppm( struct pyramid *p, int level, FILE *file )
+{
+	if(level<0 || level>=p->header->levels) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	const struct pyramid_level *l = &p->header->level[level];
+
+	if(fprintf(file,"P6\n%d %d\n255\n",l->width,l->height)<0) return 0;
+
+	for(int ty=0;ty<l->tiles_y;ty++) {
+		int rows = l->height-ty*PYRAMID_TILE < PYRAMID_TILE ? l->height-ty*PYRAMID_TILE : PYRAMID_TILE;
+
+		for(int j=0;j<rows;j++) {
+			for(int tx=0;tx<l->tiles_x;tx++) {
+				int cols = l->width-tx*PYRAMID_TILE < PYRAMID_TILE ? l->width-tx*PYRAMID_TILE : PYRAMID_TILE;
+				unsigned char *row = pyramid_tile(p,level,tx,ty) + (size_t)j*PYRAMID_TILE*3;
+				if(fwrite(row,3,cols,file)!=(size_t)cols) return 0;
+			}
+		}
+
+		/* Done with this row of tiles. */
+		for(int tx=0;tx<l->tiles_x;tx++) madvise(pyramid_tile(p,level,tx,ty),PYRAMID_TILE_BYTES,MADV_DONTNEED);
+	}
+
+	return fflush(file)==0;
+}
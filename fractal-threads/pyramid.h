@@ -0,0 +1,86 @@
+/*
+pyramid.h - A tiled image on disk, far bigger than memory, with every
+coarser level down to a single tile.
+The file is mapped into memory whole, but only the tiles being worked
+on are ever resident: a finished tile is flushed to disk and dropped
+from the mapping.  Each tile has a flag that is only set once its
+pixels are safely on disk, so a render that was interrupted can carry
+on with just the tiles that are missing.
+*/
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Side length of a tile, whose RGB pixels are then a whole number of pages. */
+#define PYRAMID_TILE 256
+
+/* Enough levels to halve any int sized image down to one tile. */
+#define PYRAMID_MAX_LEVELS 32
+
+struct pyramid_level {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	/* Where the level's done flags, one byte per tile, and its tiles start in the file. */
+	size_t done;
+	size_t data;
+};
+
+/* The start of the file, which says what the image is and how it is laid out. */
+struct pyramid_header {
+	char magic[4];
+	int version;
+	int width;
+	int height;
+	int levels;
+
+	/* What was drawn, so a different poster is never mixed into this one. */
+	double view[4];
+	int maxiter;
+	int mode;
+
+	struct pyramid_level level[PYRAMID_MAX_LEVELS];
+};
+
+struct pyramid {
+	int fd;
+	unsigned char *map;
+	size_t size;
+	struct pyramid_header *header;
+};
+
+/* How many levels a width x height poster has, down to the one that fits in a single tile. */
+int pyramid_levels( int width, int height );
+
+/*
+Open the pyramid in the file at path, or create it if there is none.
+An existing file must describe the same image: the same size, view,
+maxiter and mode.  Return 0 on failure, with errno set to EINVAL if the
+file holds some other image.
+*/
+struct pyramid *pyramid_open( const char *path, int width, int height, const double view[4], int maxiter, int mode );
+
+/* Flush everything to disk and close the file. */
+void pyramid_close( struct pyramid *p );
+
+/* Return the tile's RGB pixels, three bytes each, rows PYRAMID_TILE pixels apart. */
+unsigned char *pyramid_tile( struct pyramid *p, int level, int tx, int ty );
+
+/* Return true if the tile is complete on disk. */
+int pyramid_done( struct pyramid *p, int level, int tx, int ty );
+
+/* Flush a tile to disk, drop it from memory, and only then mark it complete. Return 0 on failure. */
+int pyramid_finish( struct pyramid *p, int level, int tx, int ty );
+
+/* Fill in a tile of a level from the four below it, averaging each 2x2 block. Level must be at least 1. */
+void pyramid_downsample( struct pyramid *p, int level, int tx, int ty );
+
+/* Write a whole level as a PPM image, a row of tiles at a time. Return 0 on failure, with errno EINVAL if there is no such level. */
+int pyramid_write_ppm( struct pyramid *p, int level, FILE *file );
+
+#endif
@@ -0,0 +1,1202 @@
+/*
+render.c - Tile based, work stealing Mandelbrot renderer.
+
+Iteration cost varies wildly between the inside of the set and the
+outside, so a fixed split of the image leaves threads idle.  Instead
+the image is cut into tiles, the tiles are dealt round robin onto one
+deque per thread, and each thread works through its own deque before
+stealing from the others.  A single atomic counter of unfinished tasks
+tells the threads when the frame is done.
+
+In tiered mode each frame looks at its pixel size and uses float
+kernels while they can still tell the pixels apart, or double-double
+once double no longer can.  Those frames keep no orbits.
+
+An antialiased frame has one more round of tasks once its counts are
+all in: every tile that changed, or is next to one that did, is colored
+again with its edge pixels, those whose count is far from a neighbor's,
+averaged over a grid of samples.  The samples are the pixels of a frame
+n times the size, so they work with every precision tier, and the
+first one is the pixel itself.
+
+With a cache, a whole frame first copies in every grid tile the cache
+holds for the view and only hands out the others, then keeps those
+once the frame is done.  Pans and resumes leave the cache alone, since
+their strips and pixels do not line up with whole tiles.
+
+Every computed pixel keeps its orbit, so when only maxiter goes up the
+pixels that hit the old limit carry on instead of starting from zero.
+Subdivide mode fills pixels without iterating them, and deep zooms
+keep offsets from a reference orbit instead of z, so their frames
+cannot be resumed and fall back to a full render.
+
+A progressive frame is drawn in passes, each one computing only the
+pixels that the coarser passes skipped and drawing each as a block that
+the finer passes then fill in.  The coarse pixels are at exactly the
+same coordinates, so the finished frame is the same as a plain one.
+
+A task may push more tasks while it runs, as subdivide mode does.
+It adds them to the counter before it takes itself off, so the count
+cannot reach zero while any part of the frame is still unfinished.
+
+While tracing, every thread records each task it runs, with the
+iterations and pixels it computed, and every stretch it spends looking
+for one.  The kernels are called from several levels down, so the
+counts are kept per thread and read off when the task finishes.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "render.h"
+#include "mandel.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+struct render *render_create( int width, int height, int maxthreads )
+{
+	struct render *r = calloc(1,sizeof(*r));
+	if(!r) return 0;
+
+	r->width = width;
+	r->height = height;
+	r->maxthreads = maxthreads;
+	r->frame_width = width;
+	r->frame_height = height;
+	r->region_width = width;
+	r->region_height = height;
+	r->tier = MANDEL_DOUBLE;
+	r->scheme = PALETTE_GRAY;
+	r->antialias_threshold = RENDER_AA_THRESHOLD;
+	palette_init(&r->palette);
+
+	int tw = (width+RENDER_TILE_SIZE-1)/RENDER_TILE_SIZE;
+	int th = (height+RENDER_TILE_SIZE-1)/RENDER_TILE_SIZE;
+	r->ntiles = tw*th;
+
+	r->iters = calloc((size_t)width*height,sizeof(int));
+	r->pixels = calloc((size_t)width*height,sizeof(unsigned int));
+	r->zr = calloc((size_t)width*height,sizeof(double));
+	r->zi = calloc((size_t)width*height,sizeof(double));
+	r->tiles = calloc(r->ntiles,sizeof(struct render_tile));
+	r->cached = calloc(r->ntiles,sizeof(char));
+
+	/* Subdivided pieces are at least a few pixels on a side, so this covers every piece a frame can make. */
+	r->maxtasks = r->ntiles + width*height/16;
+	r->tasks = calloc(r->maxtasks,sizeof(struct render_tile));
+
+	r->deques = calloc(maxthreads,sizeof(struct deque));
+	r->busy = calloc(maxthreads,sizeof(double));
+	r->pool = pool_create(maxthreads);
+
+	if(!r->iters || !r->pixels || !r->zr || !r->zi || !r->tiles || !r->cached || !r->tasks || !r->deques || !r->busy || !r->pool) {
+		render_delete(r);
+		return 0;
+	}
+
+	/* Cut the image into tiles, trimming the ones on the right and bottom edges. */
+	int t = 0;
+	for(int ty=0;ty<th;ty++) {
+		for(int tx=0;tx<tw;tx++) {
+			struct render_tile *tile = &r->tiles[t++];
+			tile->x = tx*RENDER_TILE_SIZE;
+			tile->y = ty*RENDER_TILE_SIZE;
+			tile->w = width-tile->x < RENDER_TILE_SIZE ? width-tile->x : RENDER_TILE_SIZE;
+			tile->h = height-tile->y < RENDER_TILE_SIZE ? height-tile->y : RENDER_TILE_SIZE;
+		}
+	}
+
+	/* Any one deque may end up holding every task. */
+	for(int i=0;i<maxthreads;i++) {
+		if(!deque_init(&r->deques[i],r->maxtasks)) {
+			render_delete(r);
+			return 0;
+		}
+	}
+
+	return r;
+}
+
+void render_delete( struct render *r )
+{
+	if(!r) return;
+
+	pool_delete(r->pool);
+
+	if(r->deques) {
+		for(int i=0;i<r->maxthreads;i++) deque_free(&r->deques[i]);
+	}
+
+	palette_free(&r->palette);
+	free(r->busy);
+	free(r->deques);
+	free(r->tasks);
+	free(r->cached);
+	free(r->tiles);
+	free(r->zi);
+	free(r->zr);
+	free(r->pixels);
+	free(r->iters);
+	free(r);
+}
+
+/* The iterations and pixels the calling thread has computed in its current task, while tracing. */
+
+static __thread long long work_iterations;
+static __thread long long work_pixels;
+
+/* Count n computed pixels whose orbits started from count from. */
+
+static void count_work( struct render *r, const int *iters, int n, int from )
+{
+	if(!r->trace) return;
+
+	long long total = 0;
+	for(int k=0;k<n;k++) total += iters[k]-from;
+
+	work_iterations += total;
+	work_pixels += n;
+}
+
+/* Convert every pixel of a rectangle to a color, by its fractional count if the frame has the orbits for it. */
+
+static void color_tile( struct render *r, const struct render_tile *tile )
+{
+	const struct palette *palette = &r->palette;
+
+	for(int j=tile->y;j<tile->y+tile->h;j++) {
+		int p = j*r->width+tile->x;
+		int *iters = &r->iters[p];
+		unsigned int *pixels = &r->pixels[p];
+
+		if(r->smooth) {
+			double *zr = &r->zr[p];
+			double *zi = &r->zi[p];
+			for(int i=0;i<tile->w;i++) {
+				pixels[i] = palette_smooth(palette,iters[i],zr[i]*zr[i]+zi[i]*zi[i]);
+			}
+		} else {
+			for(int i=0;i<tile->w;i++) {
+				pixels[i] = palette_color(palette,iters[i]);
+			}
+		}
+	}
+}
+
+/* Scale from column i to coordinate x, counting from the left of the whole frame, exactly as mandel_row does. */
+
+static double pixel_x( struct render *r, int i )
+{
+	const struct render_view *v = &r->view;
+	return v->xmin + (r->frame_x+i)*(v->xmax-v->xmin)/r->frame_width;
+}
+
+/* Scale from row j to coordinate y, counting from the top of the whole frame. */
+
+static double pixel_y( struct render *r, int j )
+{
+	const struct render_view *v = &r->view;
+	return v->ymin + (r->frame_y+j)*(v->ymax-v->ymin)/r->frame_height;
+}
+
+/* Compute n pixels of row j starting at column i, keeping where each orbit stopped. */
+
+static void compute_span( struct render *r, int i, int j, int n )
+{
+	const struct render_view *v = &r->view;
+	int p = j*r->width+i;
+
+	if(n<=0) return;
+
+	if(r->tier!=MANDEL_DOUBLE) {
+		int is[RENDER_TILE_SIZE];
+		int js[RENDER_TILE_SIZE];
+
+		for(int k=0;k<n;k+=RENDER_TILE_SIZE) {
+			int m = n-k<RENDER_TILE_SIZE ? n-k : RENDER_TILE_SIZE;
+			for(int c=0;c<m;c++) {
+				is[c] = r->frame_x+i+k+c;
+				js[c] = r->frame_y+j;
+			}
+			mandel_pixels(r->tier,&r->grid,is,js,m,v->maxiter,&r->iters[p+k]);
+		}
+		count_work(r,&r->iters[p],n,0);
+		return;
+	}
+
+	// Scale from row j to coordinate y
+	double y = pixel_y(r,j);
+
+	if(v->orbit) {
+		mandel_row_perturbed(v->orbit,v->xmin,v->xmax,r->frame_width,r->frame_x+i,n,y,v->maxiter,&r->iters[p]);
+		count_work(r,&r->iters[p],n,0);
+		return;
+	}
+
+	memset(&r->zr[p],0,n*sizeof(double));
+	memset(&r->zi[p],0,n*sizeof(double));
+	memset(&r->iters[p],0,n*sizeof(int));
+
+	if(r->formula) {
+		double xs[RENDER_TILE_SIZE];
+		double ys[RENDER_TILE_SIZE];
+
+		for(int k=0;k<n;k+=RENDER_TILE_SIZE) {
+			int m = n-k<RENDER_TILE_SIZE ? n-k : RENDER_TILE_SIZE;
+			for(int c=0;c<m;c++) {
+				xs[c] = pixel_x(r,i+k+c);
+				ys[c] = y;
+			}
+			r->formula(v->formula,xs,ys,m,v->maxiter,&r->zr[p+k],&r->zi[p+k],&r->iters[p+k]);
+		}
+	} else {
+		mandel_row_resume(v->xmin,v->xmax,r->frame_width,r->frame_x+i,n,y,v->maxiter,&r->zr[p],&r->zi[p],&r->iters[p]);
+	}
+	count_work(r,&r->iters[p],n,0);
+}
+
+/* Carry on m points from the z and count in zr, zi and iters, with the frame's formula if it has one. */
+
+static void resume_points( struct render *r, const double *xs, const double *ys, int m, double *zr, double *zi, int *iters )
+{
+	const struct render_view *v = &r->view;
+
+	if(r->formula) {
+		r->formula(v->formula,xs,ys,m,v->maxiter,zr,zi,iters);
+	} else {
+		mandel_points_resume(xs,ys,m,v->maxiter,zr,zi,iters);
+	}
+}
+
+/* Compute n pixels of column i starting at row j. */
+
+static void compute_column( struct render *r, int i, int j, int n )
+{
+	const struct render_view *v = &r->view;
+	double xs[RENDER_TILE_SIZE];
+	double ys[RENDER_TILE_SIZE];
+	int is[RENDER_TILE_SIZE];
+	int js[RENDER_TILE_SIZE];
+	int iters[RENDER_TILE_SIZE];
+	double zr[RENDER_TILE_SIZE];
+	double zi[RENDER_TILE_SIZE];
+
+	// Scale from column i to coordinate x, and each row to its y, just as compute_span does
+	double x = pixel_x(r,i);
+
+	while(n>0) {
+		int m = n<RENDER_TILE_SIZE ? n : RENDER_TILE_SIZE;
+
+		for(int k=0;k<m;k++) {
+			xs[k] = x;
+			ys[k] = pixel_y(r,j+k);
+			is[k] = r->frame_x+i;
+			js[k] = r->frame_y+j+k;
+			zr[k] = 0;
+			zi[k] = 0;
+			iters[k] = 0;
+		}
+
+		if(r->tier!=MANDEL_DOUBLE) {
+			mandel_pixels(r->tier,&r->grid,is,js,m,v->maxiter,iters);
+		} else if(v->orbit) {
+			mandel_points_perturbed(v->orbit,xs,ys,m,v->maxiter,iters);
+		} else if(r->formula) {
+			r->formula(v->formula,xs,ys,m,v->maxiter,zr,zi,iters);
+		} else {
+			mandel_points(xs,ys,m,v->maxiter,iters);
+		}
+
+		for(int k=0;k<m;k++) r->iters[(j+k)*r->width+i] = iters[k];
+		count_work(r,iters,m,0);
+
+		j += m;
+		n -= m;
+	}
+}
+
+/* Compute every pixel of one tile and convert it to a color. */
+
+static void compute_tile( struct render *r, const struct render_tile *tile )
+{
+	for(int j=tile->y;j<tile->y+tile->h;j++) {
+		compute_span(r,tile->x,j,tile->w);
+	}
+
+	color_tile(r,tile);
+}
+
+/* Carry on every pixel of a tile that hit the old limit, then recolor the whole tile for the new one. */
+
+static void resume_tile( struct render *r, const struct render_tile *tile )
+{
+	double xs[RENDER_TILE_SIZE];
+	double ys[RENDER_TILE_SIZE];
+	double zr[RENDER_TILE_SIZE];
+	double zi[RENDER_TILE_SIZE];
+	int iters[RENDER_TILE_SIZE];
+	int where[RENDER_TILE_SIZE];
+	long resumed = 0;
+
+	for(int j=tile->y;j<tile->y+tile->h;j++) {
+		double y = pixel_y(r,j);
+		int m = 0;
+
+		/* Gather the pixels still going, at the same coordinates compute_span used. */
+		for(int i=tile->x;i<tile->x+tile->w;i++) {
+			int p = j*r->width+i;
+			if(r->iters[p]!=r->resume_from) continue;
+
+			xs[m] = pixel_x(r,i);
+			ys[m] = y;
+			zr[m] = r->zr[p];
+			zi[m] = r->zi[p];
+			iters[m] = r->iters[p];
+			where[m++] = p;
+		}
+
+		if(!m) continue;
+
+		resume_points(r,xs,ys,m,zr,zi,iters);
+		count_work(r,iters,m,r->resume_from);
+
+		for(int k=0;k<m;k++) {
+			r->zr[where[k]] = zr[k];
+			r->zi[where[k]] = zi[k];
+			r->iters[where[k]] = iters[k];
+		}
+
+		resumed += m;
+	}
+
+	__atomic_add_fetch(&r->resumed,resumed,__ATOMIC_RELAXED);
+
+	color_tile(r,tile);
+}
+
+/*
+Compute the pixels of a tile on a grid of every step'th pixel, skipping
+the ones already computed on the last pass's coarser grid, and draw
+each grid pixel as a step x step block.
+*/
+
+static void pass_tile( struct render *r, const struct render_tile *tile )
+{
+	const struct render_view *v = &r->view;
+	int step = r->pass_step;
+	int done = r->pass_done;
+	double xs[RENDER_TILE_SIZE];
+	double ys[RENDER_TILE_SIZE];
+	double zr[RENDER_TILE_SIZE];
+	double zi[RENDER_TILE_SIZE];
+	int is[RENDER_TILE_SIZE];
+	int js[RENDER_TILE_SIZE];
+	int iters[RENDER_TILE_SIZE];
+	int where[RENDER_TILE_SIZE];
+
+	for(int j=tile->y;j<tile->y+tile->h;j+=step) {
+		double y = pixel_y(r,j);
+		int m = 0;
+
+		for(int i=tile->x;i<tile->x+tile->w;i+=step) {
+			if(done && i%done==0 && j%done==0) continue;
+
+			xs[m] = pixel_x(r,i);
+			ys[m] = y;
+			zr[m] = 0;
+			zi[m] = 0;
+			iters[m] = 0;
+			is[m] = r->frame_x+i;
+			js[m] = r->frame_y+j;
+			where[m++] = j*r->width+i;
+		}
+
+		if(m && r->tier!=MANDEL_DOUBLE) {
+			mandel_pixels(r->tier,&r->grid,is,js,m,v->maxiter,iters);
+			for(int k=0;k<m;k++) r->iters[where[k]] = iters[k];
+		} else if(m && v->orbit) {
+			mandel_points_perturbed(v->orbit,xs,ys,m,v->maxiter,iters);
+			for(int k=0;k<m;k++) r->iters[where[k]] = iters[k];
+		} else if(m) {
+			resume_points(r,xs,ys,m,zr,zi,iters);
+
+			for(int k=0;k<m;k++) {
+				r->zr[where[k]] = zr[k];
+				r->zi[where[k]] = zi[k];
+				r->iters[where[k]] = iters[k];
+			}
+		}
+
+		count_work(r,iters,m,0);
+
+		if(step==1) continue;
+
+		/* Spread each grid pixel over its block, for the finer passes to overwrite. */
+		int jend = j+step<tile->y+tile->h ? j+step : tile->y+tile->h;
+		for(int i=tile->x;i<tile->x+tile->w;i+=step) {
+			int value = r->iters[j*r->width+i];
+			int iend = i+step<tile->x+tile->w ? i+step : tile->x+tile->w;
+
+			for(int b=j;b<jend;b++) {
+				for(int a=i;a<iend;a++) r->iters[b*r->width+a] = value;
+			}
+		}
+	}
+
+	color_tile(r,tile);
+}
+
+/*
+Return true if pixel (i,j)'s count is too far from one of its neighbors'.
+Only neighbors that this frame computed and that lie within the whole
+frame count, so a region sees the same edges as the frame it is part of.
+*/
+
+static int is_edge( struct render *r, int i, int j )
+{
+	int w = r->width;
+	int p = j*w+i;
+	int c = r->iters[p];
+	int t = r->antialias_threshold;
+	int x = r->frame_x+i;
+	int y = r->frame_y+j;
+
+	if(i>0 && x>0 && abs(r->iters[p-1]-c)>t) return 1;
+	if(i<r->region_width-1 && x<r->frame_width-1 && abs(r->iters[p+1]-c)>t) return 1;
+	if(j>0 && y>0 && abs(r->iters[p-w]-c)>t) return 1;
+	if(j<r->region_height-1 && y<r->frame_height-1 && abs(r->iters[p+w]-c)>t) return 1;
+
+	return 0;
+}
+
+/*
+Color a tile again, and then make each edge pixel the average color of
+n x n samples spread over it, where the first sample is the pixel itself.
+The samples for a whole row of the tile go to the kernels in one batch.
+*/
+
+static void antialias_tile( struct render *r, const struct render_tile *tile )
+{
+	const struct render_view *v = &r->view;
+	const struct palette *palette = &r->palette;
+	int n = r->antialias;
+	double xs[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	double ys[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	double zr[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	double zi[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	int is[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	int js[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	int iters[RENDER_TILE_SIZE*RENDER_AA_MAX*RENDER_AA_MAX];
+	int where[RENDER_TILE_SIZE];
+
+	/* The grid of a frame n times the size, whose pixel (i*n+a,j*n+b) is a sample of pixel (i,j). */
+	struct mandel_grid grid = r->grid;
+	grid.width *= n;
+	grid.height *= n;
+	double xscale = (v->xmax-v->xmin)/(r->frame_width*n);
+	double yscale = (v->ymax-v->ymin)/(r->frame_height*n);
+
+	/* Start from the plain colors, in case a pixel moved here by a pan is no longer an edge. */
+	color_tile(r,tile);
+
+	for(int j=tile->y;j<tile->y+tile->h;j++) {
+		int edges = 0;
+		int m = 0;
+
+		for(int i=tile->x;i<tile->x+tile->w;i++) {
+			if(!is_edge(r,i,j)) continue;
+			where[edges++] = i;
+
+			for(int b=0;b<n;b++) {
+				for(int a=0;a<n;a++) {
+					if(!a && !b) continue;
+					is[m] = (r->frame_x+i)*n+a;
+					js[m] = (r->frame_y+j)*n+b;
+					xs[m] = v->xmin + is[m]*xscale;
+					ys[m] = v->ymin + js[m]*yscale;
+					zr[m] = 0;
+					zi[m] = 0;
+					iters[m] = 0;
+					m++;
+				}
+			}
+		}
+
+		if(!edges) continue;
+
+		if(r->tier!=MANDEL_DOUBLE) {
+			mandel_pixels(r->tier,&grid,is,js,m,v->maxiter,iters);
+		} else if(v->orbit) {
+			mandel_points_perturbed(v->orbit,xs,ys,m,v->maxiter,iters);
+		} else {
+			resume_points(r,xs,ys,m,zr,zi,iters);
+		}
+		count_work(r,iters,m,0);
+
+		/* Average the samples of each edge pixel channel by channel, its own color first. */
+		int per = n*n-1;
+		for(int e=0;e<edges;e++) {
+			unsigned int *pixel = &r->pixels[j*r->width+where[e]];
+			unsigned int red = *pixel>>16 & 0xff;
+			unsigned int green = *pixel>>8 & 0xff;
+			unsigned int blue = *pixel & 0xff;
+
+			for(int k=e*per;k<(e+1)*per;k++) {
+				unsigned int color = r->smooth ? palette_smooth(palette,iters[k],zr[k]*zr[k]+zi[k]*zi[k]) : palette_color(palette,iters[k]);
+				red += color>>16 & 0xff;
+				green += color>>8 & 0xff;
+				blue += color & 0xff;
+			}
+
+			red = (red+n*n/2)/(n*n);
+			green = (green+n*n/2)/(n*n);
+			blue = (blue+n*n/2)/(n*n);
+			*pixel = red<<16 | green<<8 | blue;
+		}
+	}
+}
+
+/* Put a task on thread id's deque, counting it as pending first. Return 0 if there is no room. */
+
+static int push_task( struct render *r, int id, const struct render_tile *task )
+{
+	int t = __atomic_fetch_add(&r->ntasks,1,__ATOMIC_RELAXED);
+	if(t>=r->maxtasks) return 0;
+
+	r->tasks[t] = *task;
+	__atomic_add_fetch(&r->pending,1,__ATOMIC_RELAXED);
+
+	if(!deque_push(&r->deques[id],t)) {
+		__atomic_sub_fetch(&r->pending,1,__ATOMIC_RELAXED);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Return true if every pixel on the edge of the rectangle has the same count. */
+
+static int uniform_border( struct render *r, const struct render_tile *tile )
+{
+	int w = r->width;
+	int *top = &r->iters[tile->y*w+tile->x];
+	int *bottom = &r->iters[(tile->y+tile->h-1)*w+tile->x];
+	int value = top[0];
+
+	for(int i=0;i<tile->w;i++) {
+		if(top[i]!=value || bottom[i]!=value) return 0;
+	}
+
+	for(int j=1;j<tile->h-1;j++) {
+		if(top[j*w]!=value || top[j*w+tile->w-1]!=value) return 0;
+	}
+
+	return 1;
+}
+
+/*
+Mariani-Silver: make sure the border is known, then either fill
+the inside from it, compute a small inside outright, or compute a
+cross through the middle and hand out the four quarters as tasks.
+Only the pixels inside the border are written here, so neighboring
+tasks never touch the same pixel.
+*/
+
+static void subdivide_tile( struct render *r, int id, const struct render_tile *tile )
+{
+	int x = tile->x;
+	int y = tile->y;
+	int w = tile->w;
+	int h = tile->h;
+
+	if(!tile->border) {
+		compute_span(r,x,y,w);
+		if(h>1) compute_span(r,x,y+h-1,w);
+		if(h>2) {
+			compute_column(r,x,y+1,h-2);
+			if(w>1) compute_column(r,x+w-1,y+1,h-2);
+		}
+	}
+
+	if(w<=2 || h<=2) return;
+
+	if(uniform_border(r,tile)) {
+		int value = r->iters[y*r->width+x];
+		for(int j=y+1;j<y+h-1;j++) {
+			int *iters = &r->iters[j*r->width];
+			for(int i=x+1;i<x+w-1;i++) iters[i] = value;
+		}
+		return;
+	}
+
+	if(w<=RENDER_SUBDIVIDE_MIN || h<=RENDER_SUBDIVIDE_MIN) {
+		for(int j=y+1;j<y+h-1;j++) compute_span(r,x+1,j,w-2);
+		return;
+	}
+
+	/* Cut along the middle row and column; each quarter shares its edges with them. */
+	int mx = x+w/2;
+	int my = y+h/2;
+
+	compute_span(r,x+1,my,w-2);
+	compute_column(r,mx,y+1,my-y-1);
+	compute_column(r,mx,my+1,y+h-my-2);
+
+	struct render_tile quarters[4] = {
+		{ x,  y,  mx-x+1,   my-y+1,   1 },
+		{ mx, y,  x+w-mx,   my-y+1,   1 },
+		{ x,  my, mx-x+1,   y+h-my,   1 },
+		{ mx, my, x+w-mx,   y+h-my,   1 },
+	};
+
+	for(int q=0;q<4;q++) {
+		/* If the task table is full, just do the quarter here. */
+		if(!push_task(r,id,&quarters[q])) subdivide_tile(r,id,&quarters[q]);
+	}
+}
+
+/* Find a tile for thread id: its own deque first, then everyone else's. Return 2 if it was stolen. */
+
+static int next_tile( struct render *r, int id, int *tile )
+{
+	if(deque_pop(&r->deques[id],tile)) return 1;
+
+	for(int k=1;k<r->nthreads;k++) {
+		if(deque_steal(&r->deques[(id+k)%r->nthreads],tile)) return 2;
+	}
+
+	return 0;
+}
+
+/* Return the time in seconds, for measuring how long each thread is busy. */
+
+static double render_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* Record the task thread id just finished, or the time it spent idle, with the work counted since the last one. */
+
+static void trace_task( struct render *r, int id, int kind, const struct render_tile *tile, long long start )
+{
+	struct trace_event e;
+
+	e.kind = kind;
+	e.start = start;
+	e.duration = trace_now(r->trace)-start;
+	e.x = tile ? r->frame_x+tile->x : 0;
+	e.y = tile ? r->frame_y+tile->y : 0;
+	e.w = tile ? tile->w : 0;
+	e.h = tile ? tile->h : 0;
+	e.iterations = work_iterations;
+	e.pixels = work_pixels;
+
+	trace_add(r->trace,id,&e);
+	work_iterations = 0;
+	work_pixels = 0;
+}
+
+/* Thread body: keep taking tiles until none are left unfinished. */
+
+static void compute_image( int id, void *arg )
+{
+	struct render *r = arg;
+	double busy = 0;
+	long long idle = -1;
+	int tile;
+
+	while(__atomic_load_n(&r->pending,__ATOMIC_ACQUIRE)>0) {
+		int found = next_tile(r,id,&tile);
+		if(found) {
+			double start = render_clock();
+			long long traced = 0;
+
+			if(r->trace) {
+				if(idle>=0) trace_task(r,id,TRACE_IDLE,0,idle);
+				idle = -1;
+				traced = trace_now(r->trace);
+			}
+
+			if(__atomic_load_n(&r->cancelled,__ATOMIC_RELAXED)) {
+				/* The frame was abandoned, so just clear out the tasks. */
+			} else if(r->aa_pass) {
+				antialias_tile(r,&r->tasks[tile]);
+			} else if(r->resume_from) {
+				resume_tile(r,&r->tasks[tile]);
+			} else if(r->pass_step) {
+				pass_tile(r,&r->tasks[tile]);
+			} else if(r->subdivide) {
+				subdivide_tile(r,id,&r->tasks[tile]);
+			} else {
+				compute_tile(r,&r->tasks[tile]);
+			}
+			busy += render_clock()-start;
+			if(r->trace) trace_task(r,id,found==2 ? TRACE_STEAL : TRACE_TILE,&r->tasks[tile],traced);
+			__atomic_sub_fetch(&r->pending,1,__ATOMIC_RELEASE);
+
+			/* Only the calling thread may look for input, so it is the one that checks. */
+			if(id==0 && r->interrupt && r->interrupt()) {
+				__atomic_store_n(&r->cancelled,1,__ATOMIC_RELAXED);
+			}
+		} else {
+			/* Everything left is being worked on by someone else. */
+			if(r->trace && idle<0) idle = trace_now(r->trace);
+			sched_yield();
+		}
+	}
+
+	if(r->trace && idle>=0) trace_task(r,id,TRACE_IDLE,0,idle);
+	r->busy[id] += busy;
+}
+
+/* Thread body for the color pass: every thread takes an equal share of the rows. */
+
+static void color_rows( int id, void *arg )
+{
+	struct render *r = arg;
+	struct render_tile rows;
+
+	rows.x = 0;
+	rows.w = r->width;
+	rows.y = r->height*id/r->nthreads;
+	rows.h = r->height*(id+1)/r->nthreads - rows.y;
+	rows.border = 0;
+
+	color_tile(r,&rows);
+}
+
+/* Replace the tasks with the grid tiles to antialias: every one that a task touched or is next to, except those from the cache. */
+
+static void add_edge_tiles( struct render *r )
+{
+	int tw = (r->width+RENDER_TILE_SIZE-1)/RENDER_TILE_SIZE;
+	char touched[r->ntiles];
+	memset(touched,0,r->ntiles);
+
+	/* A full task table counts the pieces it had no room for too. */
+	int ntasks = r->ntasks<r->maxtasks ? r->ntasks : r->maxtasks;
+
+	for(int k=0;k<ntasks;k++) {
+		const struct render_tile *task = &r->tasks[k];
+
+		/* A pixel just outside the task has a new neighbor, so it may have become an edge or stopped being one. */
+		int x0 = task->x>0 ? task->x-1 : 0;
+		int y0 = task->y>0 ? task->y-1 : 0;
+		int x1 = task->x+task->w<r->width ? task->x+task->w : r->width-1;
+		int y1 = task->y+task->h<r->height ? task->y+task->h : r->height-1;
+
+		for(int ty=y0/RENDER_TILE_SIZE;ty<=y1/RENDER_TILE_SIZE;ty++) {
+			for(int tx=x0/RENDER_TILE_SIZE;tx<=x1/RENDER_TILE_SIZE;tx++) touched[ty*tw+tx] = 1;
+		}
+	}
+
+	r->ntasks = 0;
+	for(int t=0;t<r->ntiles;t++) {
+		if(touched[t] && !r->cached[t]) r->tasks[r->ntasks++] = r->tiles[t];
+	}
+}
+
+/* Deal the tasks out round robin, so every thread starts with a mix of cheap and expensive ones, and run them. */
+
+static void run_tasks( struct render *r, int nthreads )
+{
+	for(int i=0;i<nthreads;i++) deque_reset(&r->deques[i]);
+	for(int t=0;t<r->ntasks;t++) deque_push(&r->deques[t%nthreads],t);
+	r->pending = r->ntasks;
+
+	/* Wake the pool up; the calling thread does its share as thread 0. */
+	pool_run(r->pool,nthreads,compute_image,r);
+}
+
+/* Run this frame's tasks, color them if they were subdivided, and antialias them if asked to. */
+
+static void render_run( struct render *r, int nthreads )
+{
+	for(int i=0;i<r->maxthreads;i++) r->busy[i] = 0;
+
+	long long start = 0;
+	if(r->trace) {
+		trace_next_frame(r->trace);
+		start = trace_now(r->trace);
+	}
+
+	run_tasks(r,nthreads);
+
+	/* Subdivided tasks share their edges, so the colors are filled in once everything is counted. */
+	if(r->subdivide && !r->pass_step && !r->cancelled) pool_run(r->pool,nthreads,color_rows,r);
+
+	/* Edges depend on the neighbors, so they wait until every count is in. The coarse passes are not worth it. */
+	if(r->antialias && r->pass_step<=1 && !r->cancelled) {
+		add_edge_tiles(r);
+		r->aa_pass = 1;
+		run_tasks(r,nthreads);
+		r->aa_pass = 0;
+	}
+
+	/* The frame goes in thread 0's buffer, now that the others have stopped. */
+	if(r->trace) {
+		struct render_tile frame = { 0, 0, r->width, r->height, 0 };
+		trace_task(r,0,TRACE_FRAME,&frame,start);
+	}
+
+	r->valid = !r->cancelled;
+}
+
+/* Pick the precision tier for a view: double unless in tiered mode, and always double for a deep zoom or a formula. */
+
+static int pick_tier( struct render *r, const struct render_view *view )
+{
+	if(!r->tiered || view->orbit || view->formula) return MANDEL_DOUBLE;
+
+	double pixel = fmin(fabs(view->xmax-view->xmin)/r->frame_width,fabs(view->ymax-view->ymin)/r->frame_height);
+	double extent = fmax(fmax(fabs(view->xmin),fabs(view->xmax)),fmax(fabs(view->ymin),fabs(view->ymax)));
+
+	return mandel_tier(pixel,extent);
+}
+
+/* Return true if a frame of this view keeps the orbit of every pixel it computes. */
+
+static int keeps_orbits( struct render *r, const struct render_view *view )
+{
+	return !r->subdivide && !view->orbit && pick_tier(r,view)==MANDEL_DOUBLE;
+}
+
+/* Set up a frame for the given view and thread count, with no tasks yet. */
+
+static void render_begin( struct render *r, const struct render_view *view, int nthreads )
+{
+	if(nthreads<1) nthreads = 1;
+	if(nthreads>r->maxthreads) nthreads = r->maxthreads;
+
+	r->view = *view;
+	r->nthreads = nthreads;
+	r->ntasks = 0;
+	r->tier = pick_tier(r,view);
+	r->formula = view->formula && !view->orbit ? mandel_formula_kernel(view->formula) : 0;
+	r->grid.xmin = view->xmin;
+	r->grid.xmax = view->xmax;
+	r->grid.ymin = view->ymin;
+	r->grid.ymax = view->ymax;
+	r->grid.width = r->frame_width;
+	r->grid.height = r->frame_height;
+	r->region_width = r->width;
+	r->region_height = r->height;
+	r->resume_from = 0;
+	r->pass_step = 0;
+	r->pass_done = 0;
+	r->cancelled = 0;
+	if(r->antialias<2) r->antialias = 0;
+	if(r->antialias>RENDER_AA_MAX) r->antialias = RENDER_AA_MAX;
+	r->smooth = r->scheme==PALETTE_GRADIENT && keeps_orbits(r,view);
+
+	/* The smooth table is worked out for squaring, so other powers keep the bands. */
+	if(r->formula && view->formula->power!=2) r->smooth = 0;
+
+	/* Without the colors the frame cannot be drawn, so give it up as if interrupted. */
+	if(!palette_update(&r->palette,r->scheme,view->maxiter)) r->cancelled = 1;
+}
+
+/* Add the part of every grid tile that lies inside the rectangle as a task. */
+
+static void add_region( struct render *r, int x, int y, int w, int h )
+{
+	for(int t=0;t<r->ntiles;t++) {
+		struct render_tile tile = r->tiles[t];
+
+		/* None of this frame comes from the cache. */
+		r->cached[t] = 0;
+
+		int x0 = tile.x>x ? tile.x : x;
+		int y0 = tile.y>y ? tile.y : y;
+		int x1 = tile.x+tile.w<x+w ? tile.x+tile.w : x+w;
+		int y1 = tile.y+tile.h<y+h ? tile.y+tile.h : y+h;
+
+		if(x0>=x1 || y0>=y1) continue;
+
+		tile.x = x0;
+		tile.y = y0;
+		tile.w = x1-x0;
+		tile.h = y1-y0;
+		tile.border = 0;
+		r->tasks[r->ntasks++] = tile;
+	}
+}
+
+/* Fill in the cache key of grid tile t for a view. Return 0 if the view cannot be cached. */
+
+static int tile_key( struct render *r, const struct render_view *view, int t, struct cache_key *key )
+{
+	double xpixel = (view->xmax-view->xmin)/r->width;
+	double ypixel = (view->ymax-view->ymin)/r->height;
+	double x = view->xmin/xpixel*RENDER_CACHE_QUANTUM;
+	double y = view->ymin/ypixel*RENDER_CACHE_QUANTUM;
+
+	/* A deep zoom is relative to a reference orbit that moves under it, and a degenerate view has no pixel size. */
+	if(view->orbit || !(fabs(x)<1e18) || !(fabs(y)<1e18)) return 0;
+
+	memset(key,0,sizeof(*key));
+	key->view[0] = llround(x);
+	key->view[1] = llround(y);
+	key->view[2] = llround(log2(fabs(xpixel))*RENDER_CACHE_SCALE);
+	key->view[3] = llround(log2(fabs(ypixel))*RENDER_CACHE_SCALE);
+	key->maxiter = view->maxiter;
+	key->mode = r->subdivide | r->tiered<<1 | mandel_accelerated()<<2 | r->scheme<<3 | r->antialias<<4 | r->antialias_threshold<<8;
+	if(view->formula) {
+		key->family = view->formula->family;
+		key->power = view->formula->power;
+		key->constant[0] = view->formula->kr;
+		key->constant[1] = view->formula->ki;
+	}
+	key->width = r->width;
+	key->height = r->height;
+	key->x = r->tiles[t].x;
+	key->y = r->tiles[t].y;
+	return 1;
+}
+
+/* Copy in every grid tile the cache has for the view, and add the others as tasks. */
+
+static void add_uncached( struct render *r, const struct render_view *view )
+{
+	struct cache_key key;
+	r->reused = 0;
+
+	for(int t=0;t<r->ntiles;t++) {
+		const struct render_tile *tile = &r->tiles[t];
+		int p = tile->y*r->width+tile->x;
+
+		r->cached[t] = r->cache && tile_key(r,view,t,&key)
+			&& cache_get(r->cache,&key,&r->iters[p],&r->pixels[p],r->width,tile->w,tile->h);
+
+		if(r->cached[t]) {
+			r->reused += tile->w*tile->h;
+		} else {
+			r->tasks[r->ntasks++] = *tile;
+		}
+	}
+}
+
+/* Keep every grid tile of a finished frame that did not come from the cache. */
+
+static void store_tiles( struct render *r )
+{
+	struct cache_key key;
+
+	if(!r->cache || !r->valid) return;
+
+	for(int t=0;t<r->ntiles;t++) {
+		const struct render_tile *tile = &r->tiles[t];
+		int p = tile->y*r->width+tile->x;
+
+		if(r->cached[t] || !tile_key(r,&r->view,t,&key)) continue;
+		cache_put(r->cache,&key,&r->iters[p],&r->pixels[p],r->width,tile->w,tile->h);
+	}
+}
+
+/* Draw the whole view coarse to fine, showing each coarse pass, until it is done or abandoned. */
+
+static void render_passes( struct render *r, const struct render_view *view, int nthreads )
+{
+	static const int steps[] = { 4, 2, 1 };
+	int done = 0;
+
+	for(int k=0;k<3;k++) {
+		render_begin(r,view,nthreads);
+
+		/* The first pass finds out which tiles the cache can fill in, and the others skip them. */
+		if(k==0) {
+			add_uncached(r,view);
+		} else {
+			for(int t=0;t<r->ntiles;t++) {
+				if(!r->cached[t]) r->tasks[r->ntasks++] = r->tiles[t];
+			}
+		}
+
+		/* Subdivide mode does its own last pass, which the coarse pixels cannot save anything on. */
+		if(steps[k]>1 || !r->subdivide) {
+			r->pass_step = steps[k];
+			r->pass_done = done;
+		}
+
+		render_run(r,r->nthreads);
+		if(!r->valid) return;
+
+		if(steps[k]>1 && r->present) r->present(r);
+		done = steps[k];
+	}
+
+	/* Tiles from the cache come without their orbits. */
+	r->resumable = keeps_orbits(r,view) && !r->reused;
+	store_tiles(r);
+}
+
+void render_image( struct render *r, const struct render_view *view, int nthreads )
+{
+	render_begin(r,view,nthreads);
+
+	add_uncached(r,view);
+	r->resumable = keeps_orbits(r,view) && !r->reused;
+
+	render_run(r,r->nthreads);
+	store_tiles(r);
+}
+
+/* Move the last frame so that new pixel (i,j) is old pixel (i+dx,j+dy). Pixels moved in from outside are left as they were. */
+
+static void shift_frame( struct render *r, int dx, int dy )
+{
+	int w = r->width;
+	int h = r->height;
+
+	int x0 = dx>0 ? 0 : -dx;
+	int n = w - (dx>0 ? dx : -dx);
+
+	/* Go through the rows in the order that never overwrites a row before it has been moved. */
+	for(int k=0;k<h;k++) {
+		int j = dy>0 ? k : h-1-k;
+		int from = j+dy;
+		if(from<0 || from>=h) continue;
+
+		memmove(&r->iters[j*w+x0],&r->iters[from*w+x0+dx],n*sizeof(int));
+		memmove(&r->pixels[j*w+x0],&r->pixels[from*w+x0+dx],n*sizeof(unsigned int));
+		memmove(&r->zr[j*w+x0],&r->zr[from*w+x0+dx],n*sizeof(double));
+		memmove(&r->zi[j*w+x0],&r->zi[from*w+x0+dx],n*sizeof(double));
+	}
+}
+
+/* If b is a only a whole number of pixels away from a, put the distance in d and return true. */
+
+static int pixel_offset( double a, double b, double span, int pixels, int *d )
+{
+	double offset = (b-a)*pixels/span;
+	double whole = round(offset);
+
+	if(fabs(offset-whole)>RENDER_PAN_TOLERANCE) return 0;
+	if(fabs(whole)>=pixels) return 0;
+
+	*d = (int)whole;
+	return 1;
+}
+
+int render_update( struct render *r, const struct render_view *view, int nthreads )
+{
+	const struct render_view *old = &r->view;
+	double xspan = view->xmax-view->xmin;
+	double yspan = view->ymax-view->ymin;
+	int dx, dy;
+
+	/* A pan keeps the same scale and the same iteration limit, and moves by whole pixels. */
+	int pan = r->valid
+		&& view->maxiter==old->maxiter
+		&& view->orbit==old->orbit
+		&& view->formula==old->formula
+		&& pick_tier(r,view)==r->tier
+		&& fabs((old->xmax-old->xmin)-xspan) <= RENDER_PAN_TOLERANCE*fabs(xspan)/r->width
+		&& fabs((old->ymax-old->ymin)-yspan) <= RENDER_PAN_TOLERANCE*fabs(yspan)/r->height
+		&& pixel_offset(old->xmin,view->xmin,xspan,r->width,&dx)
+		&& pixel_offset(old->ymin,view->ymin,yspan,r->height,&dy)
+		&& (dx || dy);
+
+	/* Raising maxiter on the same view only needs the pixels that hit the old limit. */
+	int deeper = r->valid
+		&& r->resumable
+		&& view->formula==old->formula
+		&& old->maxiter>0
+		&& view->maxiter>old->maxiter
+		&& view->xmin==old->xmin && view->xmax==old->xmax
+		&& view->ymin==old->ymin && view->ymax==old->ymax;
+
+	if(deeper) {
+		int from = old->maxiter;
+
+		render_begin(r,view,nthreads);
+		for(int t=0;t<r->ntiles;t++) r->tasks[t] = r->tiles[t];
+		r->ntasks = r->ntiles;
+		r->resume_from = from;
+		r->resumed = 0;
+
+		render_run(r,r->nthreads);
+		r->resume_from = 0;
+
+		return (int)r->resumed;
+	}
+
+	if(!pan) {
+		if(r->present) {
+			render_passes(r,view,nthreads);
+		} else {
+			render_image(r,view,nthreads);
+		}
+		return r->width*r->height - r->reused;
+	}
+
+	shift_frame(r,dx,dy);
+	render_begin(r,view,nthreads);
+
+	/* Subdivided strips leave filled pixels with no orbit behind, and other tiers keep none at all. */
+	if(!keeps_orbits(r,view)) r->resumable = 0;
+
+	/* The rows that came in at the top or bottom, then the columns that came in at a side, minus those rows. */
+	int ady = dy>0 ? dy : -dy;
+	int adx = dx>0 ? dx : -dx;
+	int rows_y = dy>0 ? r->height-dy : 0;
+	int cols_x = dx>0 ? r->width-dx : 0;
+	int cols_y = dy>0 ? 0 : ady;
+
+	if(ady) add_region(r,0,rows_y,r->width,ady);
+	if(adx) add_region(r,cols_x,cols_y,adx,r->height-ady);
+
+	render_run(r,r->nthreads);
+
+	return ady*r->width + adx*(r->height-ady);
+}
+
+void render_invalidate( struct render *r )
+{
+	r->valid = 0;
+}
+
+void render_region( struct render *r, const struct render_view *view, int frame_width, int frame_height, int x, int y, int w, int h, int nthreads )
+{
+	if(w>r->width) w = r->width;
+	if(h>r->height) h = r->height;
+
+	r->frame_x = x;
+	r->frame_y = y;
+	r->frame_width = frame_width;
+	r->frame_height = frame_height;
+
+	render_begin(r,view,nthreads);
+	r->region_width = w;
+	r->region_height = h;
+	add_region(r,0,0,w,h);
+	r->resumable = 0;
+
+	render_run(r,r->nthreads);
+
+	/* Pixels from another frame are no use to render_update. */
+	r->valid = 0;
+	r->frame_x = 0;
+	r->frame_y = 0;
+	r->frame_width = r->width;
+	r->frame_height = r->height;
+}
+
+int render_progressive( struct render *r, const struct render_view *view, int nthreads, render_present_func present, render_interrupt_func interrupt )
+{
+	r->present = present;
+	r->interrupt = interrupt;
+
+	int computed = render_update(r,view,nthreads);
+
+	r->present = 0;
+	r->interrupt = 0;
+
+	return r->valid ? computed : -1;
+}
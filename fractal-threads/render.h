@@ -0,0 +1,223 @@
+/*
+render.h - Tile based, work stealing Mandelbrot renderer.
+The image is cut into square tiles which are dealt out to one deque
+per thread.  A thread that runs out of tiles steals from the others,
+so expensive parts of the set get shared out as the frame goes on.
+
+In subdivide mode (Mariani-Silver) a tile computes only its border
+first.  If the whole border has the same count, the inside is filled
+with it; otherwise the tile is cut in four along a computed cross and
+the quarters go back on the deque as new tasks for anyone to take.
+
+A progressive frame is drawn coarse to fine, one pixel in sixteen, then
+one in four, then the rest, and can be abandoned between tiles as soon
+as the caller has something newer to show.
+*/
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "deque.h"
+#include "pool.h"
+#include "mandel.h"
+#include "palette.h"
+#include "trace.h"
+#include "cache.h"
+
+/* Side length of a tile in pixels. */
+#define RENDER_TILE_SIZE 32
+
+/* In subdivide mode, tiles this narrow or shorter are just computed outright. */
+#define RENDER_SUBDIVIDE_MIN 8
+
+/* How far from a whole number of pixels a pan may be and still reuse the last frame. */
+#define RENDER_PAN_TOLERANCE 1e-6
+
+/* Most samples per side of a pixel when antialiasing, so at most 16 per pixel. */
+#define RENDER_AA_MAX 4
+
+/* How far a pixel's count may be from a neighbor's before it is an edge worth antialiasing. */
+#define RENDER_AA_THRESHOLD 2
+
+/* Cached tiles are found by a view's corner to 1/RENDER_CACHE_QUANTUM of a pixel, and its pixel size to 1/RENDER_CACHE_SCALE of a doubling. */
+#define RENDER_CACHE_QUANTUM 64
+#define RENDER_CACHE_SCALE (1<<20)
+
+/* The region of the complex plane to draw, and how hard to try. */
+struct render_view {
+	double xmin;
+	double xmax;
+	double ymin;
+	double ymax;
+	int maxiter;
+
+	/* For a deep zoom, the reference orbit the coordinates above are offsets from, or 0. */
+	const struct mandel_orbit *orbit;
+
+	/* The Julia or Multibrot formula to draw, or 0 for the Mandelbrot set. Deep zooms are always the Mandelbrot set. */
+	const struct mandel_formula *formula;
+};
+
+/* A rectangle of pixels that one thread computes in one go. */
+struct render_tile {
+	int x;
+	int y;
+	int w;
+	int h;
+	int border;	/* The pixels around the edge are already computed. */
+};
+
+struct render;
+
+/* Show a coarse pass of a progressive frame. */
+typedef void (*render_present_func)( struct render *r );
+
+/* Return true to abandon the frame in progress. */
+typedef int (*render_interrupt_func)( void );
+
+struct render {
+	int width;
+	int height;
+
+	/* The iteration count and the color of every pixel, row by row. */
+	int *iters;
+	unsigned int *pixels;
+
+	/* Where each pixel's orbit stopped, so a higher maxiter can carry on from there. */
+	double *zr;
+	double *zi;
+
+	/* The fixed grid of tiles that every frame starts from. */
+	int ntiles;
+	struct render_tile *tiles;
+
+	/* This frame's tasks: the grid first, then any pieces cut from it. */
+	int maxtasks;
+	int ntasks;
+	struct render_tile *tasks;
+
+	/* Set to use Mariani-Silver subdivision instead of computing every pixel. */
+	int subdivide;
+
+	/* Set to let each frame use float or double-double instead of double when its pixel size allows or needs it. */
+	int tiered;
+
+	/* Samples per side to take of every edge pixel, from 2 to RENDER_AA_MAX, or 0 not to antialias; and how far apart counts must be to make an edge. */
+	int antialias;
+	int antialias_threshold;
+
+	/* The palette scheme to color with, PALETTE_GRAY unless set otherwise. */
+	int scheme;
+
+	/* The colors for this frame's maxiter, and whether this frame colors by fractional counts. */
+	struct palette palette;
+	int smooth;
+
+	/* The precision tier of this frame, and its pixels as a grid for mandel_pixels. */
+	int tier;
+	struct mandel_grid grid;
+
+	/* The kernel for the view's formula, looked up once a frame, or 0 for the Mandelbrot kernels. */
+	mandel_formula_func formula;
+
+	/* The threads, which stay alive between frames, and one deque for each. */
+	int maxthreads;
+	int nthreads;
+	struct pool *pool;
+	struct deque *deques;
+
+	/* Tasks handed out but not finished yet, across all deques. */
+	long pending;
+
+	/* The view of the last frame, and whether iters and pixels hold all of it. */
+	struct render_view view;
+	int valid;
+
+	/* Set while zr and zi hold the orbit of every pixel in the last frame. */
+	int resumable;
+
+	/* While resuming, the maxiter the last frame stopped at, and how many pixels were carried on. */
+	int resume_from;
+	long resumed;
+
+	/* While drawing progressively, what to call between passes and between tiles. */
+	render_present_func present;
+	render_interrupt_func interrupt;
+
+	/* During a coarse to fine pass, the spacing of the pixels to draw, and of the ones already drawn. */
+	int pass_step;
+	int pass_done;
+
+	/* Set while the tasks are tiles to antialias rather than to compute. */
+	int aa_pass;
+
+	/* Set once the frame in progress has been abandoned. */
+	int cancelled;
+
+	/* Seconds each thread spent on tasks during the last frame, not counting time looking for them. */
+	double *busy;
+
+	/* If set, where every thread records each task and each wait for one, made for at least maxthreads threads. */
+	struct trace *trace;
+
+	/* If set, whole frames keep their tiles here and take any the cache already has for the view. */
+	struct cache *cache;
+
+	/* Which grid tiles of this frame came from the cache, and how many pixels they hold. */
+	char *cached;
+	int reused;
+
+	/* The part of a larger frame being computed: the image is the pixels from (frame_x,frame_y) on of a frame_width x frame_height frame. Normally the whole frame. */
+	int frame_x;
+	int frame_y;
+	int frame_width;
+	int frame_height;
+
+	/* How much of the image this frame computes, from its top left corner. Normally all of it. */
+	int region_width;
+	int region_height;
+};
+
+/* Create a renderer for a width x height image, starting a pool of maxthreads threads. Return 0 on failure. */
+struct render *render_create( int width, int height, int maxthreads );
+
+/* Stop the threads and free the renderer and all of its buffers. */
+void render_delete( struct render *r );
+
+/* Compute the whole view with nthreads threads, filling in iters and pixels. */
+void render_image( struct render *r, const struct render_view *view, int nthreads );
+
+/*
+Compute a new view, reusing the last frame if the new view is the same
+size and only a whole number of pixels away.  Then the old pixels are
+shifted over and only the strips that came into view are computed.
+If only maxiter went up, just the pixels that hit the old limit are
+carried on from where their orbits stopped.
+Return the number of pixels that were computed, not counting any the
+cache had.
+*/
+int render_update( struct render *r, const struct render_view *view, int nthreads );
+
+/* Forget the last frame, so the next update computes every pixel. Call this after changing a view's orbit or formula. */
+void render_invalidate( struct render *r );
+
+/*
+Like render_update, but if the whole view has to be computed, draw it in
+passes of 1/16, 1/4 and then all of the pixels, calling present after
+each of the first two.  The calling thread checks interrupt between
+tiles, and if it returns true the frame is abandoned: the pixels are
+left half drawn, and -1 is returned instead of the number computed.
+With no present function the frame is drawn in one pass, but can still
+be abandoned the same way.
+*/
+int render_progressive( struct render *r, const struct render_view *view, int nthreads, render_present_func present, render_interrupt_func interrupt );
+
+/*
+Compute only pixels (x,y) to (x+w-1,y+h-1) of a frame_width x frame_height
+frame of the view, at exactly the coordinates a renderer of the whole
+frame would use.  They land in the top left w x h of iters and pixels,
+whose rows are still width apart.  The next update computes everything.
+*/
+void render_region( struct render *r, const struct render_view *view, int frame_width, int frame_height, int x, int y, int w, int h, int nthreads );
+
+#endif
@@ -0,0 +1,440 @@
+/*
+server.c - A daemon that serves rendered tiles over a Unix domain socket.
+
+Everything happens on one thread, in a loop much like the farm's: take
+in every request that has arrived, then draw the oldest waiting tile
+with the renderer's threads, send it to everyone waiting for it, and go
+round again.  A request for a tile already waiting adds its client to
+that tile instead of drawing it twice, and one for a tile drawn before
+comes out of the cache, which is only ever touched from this thread.
+
+A tile is drawn with render_region as a piece of the whole frame of its
+level, so it matches its neighbors exactly.  Its key in the cache is the
+bits of the view itself rather than a rounded version, since clients
+ask for the same tile with the same numbers.  Tiles are kept as colors
+and only encoded when sent, in each format at most once per drawing.
+
+Client sockets never block.  A request builds up in its client's buffer
+and is only looked at once all of it has arrived.  Replies go into the
+client's output buffer, which is sent as fast as the client reads it.
+A client with replies still to read is not listened to until it has
+read them, and one that leaves more than SERVER_MAX_OUTPUT unread is
+dropped, so a client that stalls costs nothing but its own memory.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+#include "png.h"
+#include "sock.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+struct server *server_create( const char *path, int nthreads, size_t cachebytes, const char *dir )
+{
+	struct server *s = calloc(1,sizeof(*s));
+	if(!s) return 0;
+
+	if(strlen(path)>=sizeof(s->path)) {
+		free(s);
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+
+	strcpy(s->path,path);
+	s->listener = -1;
+	s->nthreads = nthreads;
+
+	s->jobs = calloc(SERVER_MAX_JOBS,sizeof(struct server_job));
+	s->iters = calloc(SERVER_TILE*SERVER_TILE,sizeof(int));
+	s->pixels = calloc(SERVER_TILE*SERVER_TILE,sizeof(unsigned int));
+	s->renderer = render_create(SERVER_TILE,SERVER_TILE,nthreads);
+	s->cache = cache_create(cachebytes,dir);
+
+	if(!s->jobs || !s->iters || !s->pixels || !s->renderer || !s->cache) {
+		server_delete(s);
+		return 0;
+	}
+
+	s->listener = sock_listen(path,SERVER_MAX_CLIENTS);
+	if(s->listener<0) {
+		server_delete(s);
+		return 0;
+	}
+
+	return s;
+}
+
+void server_delete( struct server *s )
+{
+	if(!s) return;
+
+	for(int k=0;k<s->nclients;k++) {
+		close(s->clients[k].fd);
+		free(s->clients[k].output);
+	}
+
+	if(s->listener>=0) {
+		close(s->listener);
+		unlink(s->path);
+	}
+
+	cache_delete(s->cache);
+	render_delete(s->renderer);
+	free(s->pixels);
+	free(s->iters);
+	free(s->jobs);
+	free(s);
+}
+
+/* Return true if a request asks for a tile that exists, in a way this server can draw it. */
+
+static int server_valid( const struct server_request *q )
+{
+	return q->level>=0 && q->level<=SERVER_MAX_LEVEL
+		&& q->tx>=0 && q->tx<(1<<q->level)
+		&& q->ty>=0 && q->ty<(1<<q->level)
+		&& q->maxiter>=1
+		&& q->view[1]>q->view[0] && q->view[3]>q->view[2]
+		&& (q->scheme==PALETTE_GRAY || q->scheme==PALETTE_GRADIENT)
+		&& (q->format==SERVER_RAW || q->format==SERVER_PNG)
+		&& ((q->formula.family==MANDEL_MULTIBROT && q->formula.power==0) || mandel_formula_kernel(&q->formula));
+}
+
+/* Fill in the cache key of the tile a request asks for, whatever its format. */
+
+static void server_key( const struct server_request *q, struct cache_key *key )
+{
+	memset(key,0,sizeof(*key));
+	memcpy(key->view,q->view,sizeof(key->view));
+	key->maxiter = q->maxiter;
+	key->mode = q->scheme | mandel_accelerated()<<1;
+	key->family = q->formula.family;
+	key->power = q->formula.power;
+	key->constant[0] = q->formula.kr;
+	key->constant[1] = q->formula.ki;
+	key->width = SERVER_TILE<<q->level;
+	key->height = SERVER_TILE<<q->level;
+	key->x = q->tx*SERVER_TILE;
+	key->y = q->ty*SERVER_TILE;
+}
+
+/* Send as much of a client's waiting replies as it will take without blocking. Return 0 if it is gone. */
+
+static int server_flush( struct server_client *c )
+{
+	while(c->sent<c->length) {
+		ssize_t put = send(c->fd,c->output+c->sent,c->length-c->sent,MSG_NOSIGNAL);
+		if(put<0 && errno==EINTR) continue;
+		if(put<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if(put<=0) return 0;
+		c->sent += put;
+	}
+
+	c->length = 0;
+	c->sent = 0;
+	return 1;
+}
+
+/* Add size bytes to a client's output. Return 0 if there is no memory for them, or it has too much unread already. */
+
+static int server_append( struct server_client *c, const void *data, size_t size )
+{
+	/* What was sent already makes room at the front. */
+	if(c->sent) {
+		memmove(c->output,c->output+c->sent,c->length-c->sent);
+		c->length -= c->sent;
+		c->sent = 0;
+	}
+
+	if(c->length+size>SERVER_MAX_OUTPUT) return 0;
+
+	if(c->length+size>c->capacity) {
+		size_t capacity = c->capacity ? c->capacity : 4096;
+		while(capacity<c->length+size) capacity *= 2;
+
+		unsigned char *output = realloc(c->output,capacity);
+		if(!output) return 0;
+		c->output = output;
+		c->capacity = capacity;
+	}
+
+	if(size) memcpy(c->output+c->length,data,size);
+	c->length += size;
+	return 1;
+}
+
+/* Queue one reply, with size bytes of data after it, and start sending it. Return 0 if the client is gone. */
+
+static int server_reply( struct server_client *c, const struct server_request *q, int status, int format, const void *data, size_t size )
+{
+	struct server_reply reply;
+	reply.status = status;
+	reply.level = q->level;
+	reply.tx = q->tx;
+	reply.ty = q->ty;
+	reply.format = format;
+	reply.size = size;
+
+	return server_append(c,&reply,sizeof(reply)) && server_append(c,data,size) && server_flush(c);
+}
+
+/* Return the index of the client on fd, or -1 if it has gone. */
+
+static int server_find( struct server *s, int fd )
+{
+	for(int k=0;k<s->nclients;k++) {
+		if(s->clients[k].fd==fd) return k;
+	}
+	return -1;
+}
+
+/* Take client k out, and out of every tile it was waiting for, dropping the tiles no one else wants. */
+
+static void server_drop( struct server *s, int k )
+{
+	int fd = s->clients[k].fd;
+
+	for(int j=s->njobs-1;j>=0;j--) {
+		struct server_job *job = &s->jobs[j];
+
+		for(int w=job->nwaiters-1;w>=0;w--) {
+			if(job->waiters[w]!=fd) continue;
+			job->nwaiters--;
+			memmove(&job->waiters[w],&job->waiters[w+1],(job->nwaiters-w)*sizeof(int));
+			memmove(&job->formats[w],&job->formats[w+1],(job->nwaiters-w)*sizeof(int));
+		}
+
+		if(!job->nwaiters) {
+			s->njobs--;
+			memmove(job,job+1,(s->njobs-j)*sizeof(*job));
+		}
+	}
+
+	close(fd);
+	free(s->clients[k].output);
+	s->clients[k] = s->clients[--s->nclients];
+}
+
+static void server_accept( struct server *s )
+{
+	int fd = accept(s->listener,NULL,NULL);
+	if(fd<0) return;
+
+	if(s->nclients>=SERVER_MAX_CLIENTS || !sock_nonblocking(fd)) {
+		close(fd);
+		return;
+	}
+
+	struct server_client *c = &s->clients[s->nclients++];
+	memset(c,0,sizeof(*c));
+	c->fd = fd;
+}
+
+/* Queue a request from a client, or join it to the same tile already waiting. Return 0 if the client is gone. */
+
+static int server_queue( struct server *s, struct server_client *c, const struct server_request *q )
+{
+	struct cache_key key;
+
+	if(!server_valid(q)) return server_reply(c,q,EINVAL,q->format,0,0);
+
+	server_key(q,&key);
+
+	struct server_job *job = 0;
+	for(int j=0;j<s->njobs && !job;j++) {
+		if(!memcmp(&s->jobs[j].key,&key,sizeof(key))) job = &s->jobs[j];
+	}
+
+	if(job) {
+		if(job->nwaiters>=SERVER_MAX_CLIENTS) return server_reply(c,q,EAGAIN,q->format,0,0);
+		s->shared++;
+	} else {
+		if(s->njobs>=SERVER_MAX_JOBS) return server_reply(c,q,EAGAIN,q->format,0,0);
+		job = &s->jobs[s->njobs++];
+		job->request = *q;
+		job->key = key;
+		job->nwaiters = 0;
+	}
+
+	job->waiters[job->nwaiters] = c->fd;
+	job->formats[job->nwaiters] = q->format;
+	job->nwaiters++;
+	return 1;
+}
+
+/* Read whatever client k has sent, queueing each request once all of it is in. Return 0 if the client is gone. */
+
+static int server_receive( struct server *s, int k )
+{
+	struct server_client *c = &s->clients[k];
+
+	while(1) {
+		ssize_t got = read(c->fd,(char*)&c->request+c->received,sizeof(c->request)-c->received);
+		if(got<0 && errno==EINTR) continue;
+		if(got<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 1;
+		if(got<=0) return 0;
+
+		c->received += got;
+		if(c->received<sizeof(c->request)) continue;
+
+		c->received = 0;
+		if(!server_queue(s,c,&c->request)) return 0;
+	}
+}
+
+/* Draw the oldest waiting tile, or take it from the cache, and send it to everyone waiting for it. */
+
+static void server_serve( struct server *s )
+{
+	struct server_job job = s->jobs[0];
+	s->njobs--;
+	memmove(&s->jobs[0],&s->jobs[1],s->njobs*sizeof(struct server_job));
+
+	const struct server_request *q = &job.request;
+	int status = 0;
+
+	if(cache_get(s->cache,&job.key,s->iters,s->pixels,SERVER_TILE,SERVER_TILE,SERVER_TILE)) {
+		s->cached++;
+	} else {
+		struct render *r = s->renderer;
+		struct render_view view;
+		view.xmin = q->view[0];
+		view.xmax = q->view[1];
+		view.ymin = q->view[2];
+		view.ymax = q->view[3];
+		view.maxiter = q->maxiter;
+		view.orbit = 0;
+		view.formula = q->formula.power ? &q->formula : 0;
+
+		r->scheme = q->scheme;
+		render_region(r,&view,SERVER_TILE<<q->level,SERVER_TILE<<q->level,q->tx*SERVER_TILE,q->ty*SERVER_TILE,SERVER_TILE,SERVER_TILE,s->nthreads);
+
+		/* Only the palette can fail, when maxiter is too big for memory. */
+		if(r->cancelled) {
+			status = ENOMEM;
+		} else {
+			memcpy(s->iters,r->iters,SERVER_TILE*SERVER_TILE*sizeof(int));
+			memcpy(s->pixels,r->pixels,SERVER_TILE*SERVER_TILE*sizeof(unsigned int));
+			cache_put(s->cache,&job.key,s->iters,s->pixels,SERVER_TILE,SERVER_TILE,SERVER_TILE);
+			s->rendered++;
+		}
+	}
+
+	unsigned char *data[2] = { 0, 0 };
+	size_t size[2] = { 0, 0 };
+
+	for(int w=0;w<job.nwaiters;w++) {
+		int format = job.formats[w];
+
+		if(!status && !data[format]) {
+			if(format==SERVER_PNG) {
+				if(!png_encode(s->pixels,SERVER_TILE,SERVER_TILE,SERVER_TILE,&data[format],&size[format])) data[format] = 0;
+			} else {
+				size[format] = SERVER_TILE*SERVER_TILE*3;
+				data[format] = malloc(size[format]);
+				for(int p=0;data[format] && p<SERVER_TILE*SERVER_TILE;p++) {
+					data[format][p*3] = s->pixels[p]>>16;
+					data[format][p*3+1] = s->pixels[p]>>8;
+					data[format][p*3+2] = s->pixels[p];
+				}
+			}
+		}
+
+		/* A client dropped earlier in this loop, for this tile in another format, is already gone. */
+		int k = server_find(s,job.waiters[w]);
+		if(k<0) continue;
+
+		int sent;
+		if(status || !data[format]) {
+			sent = server_reply(&s->clients[k],q,status ? status : ENOMEM,format,0,0);
+		} else {
+			sent = server_reply(&s->clients[k],q,0,format,data[format],size[format]);
+			s->served++;
+		}
+
+		/* A client that went away takes its other requests with it. */
+		if(!sent) server_drop(s,k);
+	}
+
+	free(data[0]);
+	free(data[1]);
+}
+
+int server_run( struct server *s, volatile sig_atomic_t *stop )
+{
+	while(!*stop) {
+		struct pollfd fds[SERVER_MAX_CLIENTS+1];
+		fds[0].fd = s->listener;
+		fds[0].events = POLLIN;
+		/* A client with replies still to read is not listened to until it has read them. */
+		for(int k=0;k<s->nclients;k++) {
+			fds[k+1].fd = s->clients[k].fd;
+			fds[k+1].events = s->clients[k].length ? POLLOUT : POLLIN;
+		}
+
+		/* With tiles waiting, only pick up what has already arrived before drawing the next one. */
+		int n = poll(fds,s->nclients+1,s->njobs ? 0 : -1);
+		if(n<0 && errno==EINTR) continue;
+		if(n<0) return 0;
+
+		/* Go backwards, so a dropped client is replaced by one already handled. */
+		for(int k=s->nclients-1;k>=0;k--) {
+			int events = fds[k+1].revents;
+			int ok;
+
+			if(!events) continue;
+			if(events & (POLLERR|POLLHUP|POLLNVAL)) ok = 0;
+			else if(events & POLLOUT) ok = server_flush(&s->clients[k]);
+			else ok = server_receive(s,k);
+
+			if(!ok) server_drop(s,k);
+		}
+
+		if(fds[0].revents & POLLIN) server_accept(s);
+
+		if(s->njobs) server_serve(s);
+	}
+
+	return 1;
+}
+
+int server_fetch( int fd, const struct server_request *request, unsigned char **data, size_t *size )
+{
+	struct server_reply reply;
+
+	if(!sock_write_full(fd,request,sizeof(*request))) return 0;
+
+	if(!sock_read_full(fd,&reply,sizeof(reply))) {
+		errno = ECONNRESET;
+		return 0;
+	}
+
+	if(reply.status) {
+		errno = reply.status;
+		return 0;
+	}
+
+	if(reply.level!=request->level || reply.tx!=request->tx || reply.ty!=request->ty || reply.size<0) {
+		errno = EPROTO;
+		return 0;
+	}
+
+	*data = malloc(reply.size ? reply.size : 1);
+	if(!*data) return 0;
+
+	if(!sock_read_full(fd,*data,reply.size)) {
+		free(*data);
+		errno = ECONNRESET;
+		return 0;
+	}
+
+	*size = reply.size;
+	return 1;
+}
@@ -0,0 +1,141 @@
+/*
+server.h - A daemon that serves rendered tiles over a Unix domain socket.
+One long running process keeps a warm renderer and a cache of finished
+tiles, and any number of viewers and batch jobs connect and ask it for
+tiles.  The tiles follow the scheme of map servers: level 0 is the
+whole view in one tile, and each level splits every tile of the one
+before into four.  A tile comes back as raw RGB or as a PNG image.
+Requests for a tile that is already waiting to be drawn just wait for
+the same drawing.  A client that is slow to send or to read holds up
+no one but itself.
+*/
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <signal.h>
+#include <stddef.h>
+
+#include "mandel.h"
+#include "render.h"
+#include "cache.h"
+
+/* Side length of every tile. */
+#define SERVER_TILE 256
+
+/* The deepest level, where the whole view is 2^30 pixels across. */
+#define SERVER_MAX_LEVEL 22
+
+/* How many clients can be connected at once, and how many different tiles can be waiting. */
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_MAX_JOBS 1024
+
+/* How many bytes of replies a client may leave unread before it is dropped. */
+#define SERVER_MAX_OUTPUT (64*1024*1024)
+
+/* Tile formats: SERVER_TILE x SERVER_TILE RGB pixels, three bytes each, or a PNG file. */
+#define SERVER_RAW 0
+#define SERVER_PNG 1
+
+/* One tile, as a client asks for it. */
+struct server_request {
+	/* The whole picture at level 0: xmin, xmax, ymin and ymax. */
+	double view[4];
+	int maxiter;
+
+	/* The tile, which must be within the 2^level x 2^level tiles of its level. */
+	int level;
+	int tx;
+	int ty;
+
+	int scheme;
+	int format;
+
+	/* The formula to draw, with a power of 0 for the Mandelbrot set. */
+	struct mandel_formula formula;
+};
+
+/* What comes back, followed by size bytes of the tile. Replies come in the order the tiles are ready. */
+struct server_reply {
+	/* 0, or the errno value that says why there is no tile. */
+	int status;
+
+	/* Which tile this is, as in the request. */
+	int level;
+	int tx;
+	int ty;
+
+	int format;
+	int size;
+};
+
+/* A tile waiting to be drawn, and everyone waiting for it. */
+struct server_job {
+	struct server_request request;
+	struct cache_key key;
+
+	int nwaiters;
+	int waiters[SERVER_MAX_CLIENTS];
+	int formats[SERVER_MAX_CLIENTS];
+};
+
+/* A connected client, with the request it is partway through sending and the replies it has yet to read. */
+struct server_client {
+	int fd;
+
+	struct server_request request;
+	size_t received;
+
+	unsigned char *output;
+	size_t length;
+	size_t sent;
+	size_t capacity;
+};
+
+struct server {
+	int listener;
+	char path[108];
+
+	int nclients;
+	struct server_client clients[SERVER_MAX_CLIENTS];
+
+	/* Tiles waiting to be drawn, oldest first. */
+	int njobs;
+	struct server_job *jobs;
+
+	struct render *renderer;
+	int nthreads;
+	struct cache *cache;
+
+	/* One tile's counts and colors, on their way out of the cache. */
+	int *iters;
+	unsigned int *pixels;
+
+	/* Tiles sent, drawn, found in the cache, and requests that joined one already waiting. */
+	long served;
+	long rendered;
+	long cached;
+	long shared;
+};
+
+/*
+Listen on the socket at path, drawing with nthreads threads and keeping
+up to cachebytes of tiles, spilling to dir if it is not 0.  Return 0 on
+failure.
+*/
+struct server *server_create( const char *path, int nthreads, size_t cachebytes, const char *dir );
+
+/* Close every connection and the socket, write out the cache if it has a directory, and free the server. */
+void server_delete( struct server *s );
+
+/* Serve clients until stop is set, by a signal handler say. Return 0 if waiting for them failed. */
+int server_run( struct server *s, volatile sig_atomic_t *stop );
+
+/*
+Ask the server on fd, from sock_connect, for a tile.  Put a malloc'd copy of the tile in
+*data and its size in *size.  Return 0 on failure, with errno set to the
+server's reason if it refused.
+*/
+int server_fetch( int fd, const struct server_request *request, unsigned char **data, size_t *size );
+
+#endif
@@ -0,0 +1,102 @@
+/*
+sock.c - Unix domain sockets for the farm and the tile server.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sock.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int sock_read_full( int fd, void *buf, size_t n )
+{
+	char *p = buf;
+
+	while(n>0) {
+		ssize_t got = read(fd,p,n);
+		if(got<0 && errno==EINTR) continue;
+		if(got<=0) return 0;
+		p += got;
+		n -= got;
+	}
+
+	return 1;
+}
+
+int sock_write_full( int fd, const void *buf, size_t n )
+{
+	const char *p = buf;
+
+	while(n>0) {
+		ssize_t put = send(fd,p,n,MSG_NOSIGNAL);
+		if(put<0 && errno==EINTR) continue;
+		if(put<=0) return 0;
+		p += put;
+		n -= put;
+	}
+
+	return 1;
+}
+
+static int sock_address( const char *path, struct sockaddr_un *addr )
+{
+	if(strlen(path)>=sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+
+	memset(addr,0,sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path,path);
+	return 1;
+}
+
+int sock_listen( const char *path, int backlog )
+{
+	struct sockaddr_un addr;
+	if(!sock_address(path,&addr)) return -1;
+
+	int fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd<0) return -1;
+
+	/* A socket left behind by an earlier run would make bind fail. */
+	unlink(path);
+
+	if(bind(fd,(struct sockaddr*)&addr,sizeof(addr)) || listen(fd,backlog)) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	return fd;
+}
+
+int sock_connect( const char *path )
+{
+	struct sockaddr_un addr;
+	if(!sock_address(path,&addr)) return -1;
+
+	int fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd<0) return -1;
+
+	if(connect(fd,(struct sockaddr*)&addr,sizeof(addr))) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	return fd;
+}
+
+int sock_nonblocking( int fd )
+{
+	int flags = fcntl(fd,F_GETFL);
+	return flags>=0 && fcntl(fd,F_SETFL,flags|O_NONBLOCK)==0;
+}
@@ -0,0 +1,28 @@
+/*
+sock.h - Unix domain sockets for the farm and the tile server.
+Both talk to their clients with plain structs over a stream socket on
+one host, so they share how a socket is set up and how a whole struct
+goes across one.
+*/
+
+#ifndef SOCK_H
+#define SOCK_H
+
+#include <stddef.h>
+
+/* Read exactly n bytes. Return 0 if the other end closed or failed first. */
+int sock_read_full( int fd, void *buf, size_t n );
+
+/* Write exactly n bytes, without dying of SIGPIPE if the other end is gone. Return 0 on failure. */
+int sock_write_full( int fd, const void *buf, size_t n );
+
+/* Listen on the socket at path, replacing one left behind by an earlier run. Return the socket, or -1 on failure. */
+int sock_listen( const char *path, int backlog );
+
+/* Connect to the socket at path. Return the socket, or -1 on failure. */
+int sock_connect( const char *path );
+
+/* Make reads and writes on fd return at once with EAGAIN instead of waiting. Return 0 on failure. */
+int sock_nonblocking( int fd );
+
+#endif
@@ -0,0 +1,227 @@
+/*
+trace.c - A record of what every thread did during each frame.
+
+The binary form is a small header followed by the events as they sit
+in memory, which is only meant to be read back on the same machine.
+Events keep nanoseconds; the Chrome format wants microseconds.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define TRACE_MAGIC "FTRC"
+#define TRACE_VERSION 1
+
+struct trace_header {
+	char magic[4];
+	int version;
+	int nthreads;
+	int frames;
+	long long count;
+};
+
+static const char *trace_kind_names[] = { "frame", "tile", "steal", "row", "idle" };
+#define TRACE_KINDS (int)(sizeof(trace_kind_names)/sizeof(trace_kind_names[0]))
+
+static long long trace_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+struct trace *trace_create( int nthreads )
+{
+	struct trace *t = calloc(1,sizeof(*t));
+	if(!t) return 0;
+
+	t->buffers = calloc(nthreads,sizeof(struct trace_buffer));
+	if(!t->buffers) {
+		free(t);
+		return 0;
+	}
+
+	t->nthreads = nthreads;
+	t->origin = trace_clock();
+	return t;
+}
+
+void trace_delete( struct trace *t )
+{
+	if(!t) return;
+
+	for(int i=0;i<t->nthreads;i++) free(t->buffers[i].events);
+	free(t->buffers);
+	free(t);
+}
+
+long long trace_now( struct trace *t )
+{
+	return trace_clock() - t->origin;
+}
+
+void trace_next_frame( struct trace *t )
+{
+	t->frame++;
+}
+
+void trace_add( struct trace *t, int id, const struct trace_event *e )
+{
+	struct trace_buffer *b = &t->buffers[id];
+
+	if(b->count==b->capacity) {
+		int capacity = b->capacity ? b->capacity*2 : 1024;
+		struct trace_event *events = realloc(b->events,capacity*sizeof(struct trace_event));
+		if(!events) {
+			t->overflow = 1;
+			return;
+		}
+		b->events = events;
+		b->capacity = capacity;
+	}
+
+	struct trace_event *slot = &b->events[b->count++];
+	*slot = *e;
+	slot->thread = id;
+	slot->frame = t->frame;
+}
+
+int trace_save( struct trace *t, const char *path )
+{
+	FILE *file = fopen(path,"wb");
+	if(!file) return 0;
+
+	struct trace_header h;
+	memcpy(h.magic,TRACE_MAGIC,4);
+	h.version = TRACE_VERSION;
+	h.nthreads = t->nthreads;
+	h.frames = t->frame;
+	h.count = 0;
+	for(int i=0;i<t->nthreads;i++) h.count += t->buffers[i].count;
+
+	int ok = fwrite(&h,sizeof(h),1,file)==1;
+	for(int i=0;i<t->nthreads && ok;i++) {
+		struct trace_buffer *b = &t->buffers[i];
+		ok = b->count==0 || fwrite(b->events,sizeof(struct trace_event),b->count,file)==(size_t)b->count;
+	}
+
+	return fclose(file)==0 && ok;
+}
+
+struct trace *trace_load( const char *path )
+{
+	FILE *file = fopen(path,"rb");
+	if(!file) return 0;
+
+	struct trace_header h;
+	struct trace *t = 0;
+
+	if(fread(&h,sizeof(h),1,file)!=1 || memcmp(h.magic,TRACE_MAGIC,4) || h.version!=TRACE_VERSION || h.nthreads<1) goto fail;
+
+	t = trace_create(h.nthreads);
+	if(!t) goto fail;
+
+	for(long long k=0;k<h.count;k++) {
+		struct trace_event e;
+		if(fread(&e,sizeof(e),1,file)!=1) goto fail;
+
+		/* The writers index by thread and kind, so refuse a file that would send them out of bounds. */
+		if(e.thread<0 || e.thread>=h.nthreads || e.kind<0 || e.kind>=TRACE_KINDS) {
+			errno = EINVAL;
+			goto fail;
+		}
+
+		/* trace_add stamps the current frame, so make that the recorded one. */
+		t->frame = e.frame;
+		trace_add(t,e.thread,&e);
+		if(t->overflow) goto fail;
+	}
+
+	t->frame = h.frames;
+	fclose(file);
+	return t;
+
+fail:
+	{
+		int error = errno;
+		trace_delete(t);
+		fclose(file);
+		errno = error;
+	}
+	return 0;
+}
+
+void trace_write_json( struct trace *t, FILE *file )
+{
+	fprintf(file,"{\n\"threads\": %d,\n\"frames\": %d,\n\"events\": [\n",t->nthreads,t->frame);
+
+	int first = 1;
+	for(int i=0;i<t->nthreads;i++) {
+		struct trace_buffer *b = &t->buffers[i];
+		for(int k=0;k<b->count;k++) {
+			struct trace_event *e = &b->events[k];
+			fprintf(file,"%s{\"kind\": \"%s\", \"thread\": %d, \"frame\": %d, \"start_ns\": %lld, \"duration_ns\": %lld, "
+				"\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, \"iterations\": %lld, \"pixels\": %lld}",
+				first ? "" : ",\n",trace_kind_names[e->kind],e->thread,e->frame,e->start,e->duration,
+				e->x,e->y,e->w,e->h,e->iterations,e->pixels);
+			first = 0;
+		}
+	}
+
+	/* The totals answer the usual question, whether a slow frame was imbalance, idling or just costly pixels. */
+	fprintf(file,"\n],\n\"totals\": [\n");
+	for(int i=0;i<t->nthreads;i++) {
+		struct trace_buffer *b = &t->buffers[i];
+		long long busy = 0, idle = 0, iterations = 0, pixels = 0;
+		int tasks = 0, steals = 0;
+
+		for(int k=0;k<b->count;k++) {
+			struct trace_event *e = &b->events[k];
+			if(e->kind==TRACE_IDLE) idle += e->duration;
+			if(e->kind==TRACE_FRAME || e->kind==TRACE_IDLE) continue;
+
+			busy += e->duration;
+			iterations += e->iterations;
+			pixels += e->pixels;
+			tasks++;
+			if(e->kind==TRACE_STEAL) steals++;
+		}
+
+		fprintf(file,"%s{\"thread\": %d, \"tasks\": %d, \"steals\": %d, \"busy_ns\": %lld, \"idle_ns\": %lld, \"iterations\": %lld, \"pixels\": %lld}",
+			i ? ",\n" : "",i,tasks,steals,busy,idle,iterations,pixels);
+	}
+	fprintf(file,"\n]\n}\n");
+}
+
+void trace_write_chrome( struct trace *t, FILE *file )
+{
+	fprintf(file,"{\"traceEvents\": [\n");
+
+	for(int i=0;i<t->nthreads;i++) {
+		fprintf(file,"%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+			i ? ",\n" : "",i,i);
+	}
+
+	for(int i=0;i<t->nthreads;i++) {
+		struct trace_buffer *b = &t->buffers[i];
+		for(int k=0;k<b->count;k++) {
+			struct trace_event *e = &b->events[k];
+
+			/* Frames go on a track of their own, so they do not hide thread 0's tiles. */
+			int tid = e->kind==TRACE_FRAME ? t->nthreads : e->thread;
+
+			fprintf(file,",\n{\"name\": \"%s\", \"cat\": \"frame %d\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+				"\"args\": {\"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d, \"iterations\": %lld, \"pixels\": %lld}}",
+				trace_kind_names[e->kind],e->frame,tid,e->start/1000.0,e->duration/1000.0,
+				e->x,e->y,e->w,e->h,e->iterations,e->pixels);
+		}
+	}
+
+	fprintf(file,",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"frames\"}}\n]}\n",t->nthreads);
+}
@@ -0,0 +1,98 @@
+/*
+trace.h - A record of what every thread did during each frame.
+Each thread appends events to a buffer of its own, so recording takes
+no locks: a task with how long it took, the iterations it ran and the
+pixels it produced, or a stretch spent idle looking for work.  The
+trace is saved in a compact binary form and turned into JSON or the
+Chrome trace format (chrome://tracing, Perfetto) by fractaltrace.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* A whole frame, recorded by the thread that started it, with no counts of its own. */
+#define TRACE_FRAME 0
+
+/* A tile or a piece of one computed by the renderer. */
+#define TRACE_TILE 1
+
+/* Like TRACE_TILE, but taken from another thread's deque. */
+#define TRACE_STEAL 2
+
+/* A row computed by fractalthread. */
+#define TRACE_ROW 3
+
+/* Time spent with nothing to do, looking for work to steal. */
+#define TRACE_IDLE 4
+
+struct trace_event {
+	/* Nanoseconds from when the trace was created. */
+	long long start;
+	long long duration;
+
+	int kind;
+	int thread;
+	int frame;
+
+	/* The rectangle of pixels, if any. */
+	int x;
+	int y;
+	int w;
+	int h;
+
+	/* The iterations run and the pixels computed, rather than filled in or reused. */
+	long long iterations;
+	long long pixels;
+};
+
+/* One thread's events, kept a cache line apart from the next thread's. */
+struct trace_buffer {
+	struct trace_event *events;
+	int count;
+	int capacity;
+	char pad[64];
+};
+
+struct trace {
+	int nthreads;
+	struct trace_buffer *buffers;
+
+	/* The frame being recorded, counting from 1. */
+	int frame;
+
+	/* Set if an event was dropped for lack of memory. */
+	int overflow;
+
+	long long origin;
+};
+
+/* Create an empty trace for up to nthreads threads. Return 0 on failure. */
+struct trace *trace_create( int nthreads );
+
+/* Free the trace and its events. */
+void trace_delete( struct trace *t );
+
+/* Return the time in nanoseconds since the trace was created. */
+long long trace_now( struct trace *t );
+
+/* Start a new frame. Call this while no thread is recording. */
+void trace_next_frame( struct trace *t );
+
+/* Record an event for thread id, which only that thread may do while a frame runs. */
+void trace_add( struct trace *t, int id, const struct trace_event *e );
+
+/* Write the trace to a file in binary form. Return 0 on failure. */
+int trace_save( struct trace *t, const char *path );
+
+/* Read a trace written by trace_save. Return 0 on failure, with errno EINVAL if an event has a bad thread or kind. */
+struct trace *trace_load( const char *path );
+
+/* Write every event as a JSON object, along with each thread's totals. */
+void trace_write_json( struct trace *t, FILE *file );
+
+/* Write every event in the Chrome trace event format, one track per thread. */
+void trace_write_chrome( struct trace *t, FILE *file );
+
+#endif